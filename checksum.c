@@ -0,0 +1,210 @@
+/* Packet checksums, see checksum.h */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSE42_PATH 1
+#include <nmmintrin.h>
+/* the crc32 instruction takes 8 bytes at a time on x86-64, 4 on i386 */
+#ifdef __x86_64__
+typedef uint64_t crcword;
+#define CRCSTEP(crc, w) ((uint32_t)_mm_crc32_u64(crc, w))
+#else
+typedef uint32_t crcword;
+#define CRCSTEP(crc, w) _mm_crc32_u32(crc, w)
+#endif
+#endif
+
+static const char *names[] = { "sum", "inet", "crc32c" };
+
+int checksumkind(const char *name)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+    if (strcmp(name, names[i]) == 0)
+      return i;
+  return -1;
+}
+
+const char *checksumname(int kind)
+{
+  return names[kind];
+}
+
+/* the bytes covered, in the order they are checksummed: seqnum, acknum,
+   length and sacklen (in host byte order) and then the payload and the
+   selective ACK that follows it */
+#define HEADER 16
+
+static void header(const struct pkt *packet, unsigned char h[HEADER])
+{
+  memcpy(h, &packet->seqnum, 4);
+  memcpy(h + 4, &packet->acknum, 4);
+  memcpy(h + 8, &packet->length, 4);
+  memcpy(h + 12, &packet->sacklen, 4);
+}
+
+uint32_t cksum_sum(const struct pkt *packet)
+{
+  int checksum;
+  int i;
+
+  checksum = packet->seqnum + packet->acknum;
+  for (i = 0; i < packet->length + packet->sacklen; i++)
+    checksum += (int)(packet->payload[i]);
+  return (uint32_t)checksum;
+}
+
+/* the 16-bit words are added two at a time in a 64-bit accumulator and
+   the carries folded back in at the end (RFC 1071, section 2).  An odd
+   last byte is padded with a zero byte. */
+uint32_t cksum_inet(const struct pkt *packet)
+{
+  unsigned char h[HEADER], tail[4] = { 0, 0, 0, 0 };
+  const char *p = packet->payload;
+  uint64_t sum = 0;
+  uint32_t w;
+  int n = packet->length + packet->sacklen;
+
+  header(packet, h);
+  memcpy(&w, h, 4);
+  sum += w;
+  memcpy(&w, h + 4, 4);
+  sum += w;
+  memcpy(&w, h + 8, 4);
+  sum += w;
+  memcpy(&w, h + 12, 4);
+  sum += w;
+  for (; n >= 4; n -= 4, p += 4) {
+    memcpy(&w, p, 4);
+    sum += w;
+  }
+  if (n > 0) {
+    memcpy(tail, p, n);
+    memcpy(&w, tail, 4);
+    sum += w;
+  }
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return (uint32_t)(~sum & 0xffff);
+}
+
+/* CRC-32C, reflected polynomial 0x82f63b78, eight bytes at a time
+   ("slicing by 8"): crctable[k][b] is the CRC of byte b followed by k
+   zero bytes */
+static uint32_t crctable[8][256];
+static pthread_once_t crconce = PTHREAD_ONCE_INIT;
+
+static void crcinit(void)
+{
+  uint32_t c;
+  int i, k;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (k = 0; k < 8; k++)
+      c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+    crctable[0][i] = c;
+  }
+  for (i = 0; i < 256; i++)
+    for (k = 1; k < 8; k++)
+      crctable[k][i] = crctable[0][crctable[k - 1][i] & 0xff] ^ (crctable[k - 1][i] >> 8);
+}
+
+static uint32_t crcbytes(uint32_t crc, const unsigned char *p, int n)
+{
+  while (n >= 8) {
+    crc ^= p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    crc = crctable[7][crc & 0xff] ^ crctable[6][(crc >> 8) & 0xff] ^
+          crctable[5][(crc >> 16) & 0xff] ^ crctable[4][crc >> 24] ^
+          crctable[3][p[4]] ^ crctable[2][p[5]] ^
+          crctable[1][p[6]] ^ crctable[0][p[7]];
+    p += 8;
+    n -= 8;
+  }
+  while (n-- > 0)
+    crc = crctable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+uint32_t cksum_crc32c_table(const struct pkt *packet)
+{
+  unsigned char h[HEADER];
+  uint32_t crc;
+
+  pthread_once(&crconce, crcinit);
+  header(packet, h);
+  crc = crcbytes(0xffffffff, h, HEADER);
+  crc = crcbytes(crc, (const unsigned char *)packet->payload,
+                 packet->length + packet->sacklen);
+  return ~crc;
+}
+
+#ifdef HAVE_SSE42_PATH
+__attribute__((target("sse4.2")))
+uint32_t cksum_crc32c_sse42(const struct pkt *packet)
+{
+  unsigned char h[HEADER];
+  const unsigned char *p = (const unsigned char *)packet->payload;
+  uint32_t crc = 0xffffffff;
+  crcword w;
+  int n = packet->length + packet->sacklen;
+  size_t i;
+
+  header(packet, h);
+  for (i = 0; i < HEADER; i += sizeof(w)) {
+    memcpy(&w, h + i, sizeof(w));
+    crc = CRCSTEP(crc, w);
+  }
+  for (; n >= (int)sizeof(w); n -= sizeof(w), p += sizeof(w)) {
+    memcpy(&w, p, sizeof(w));
+    crc = CRCSTEP(crc, w);
+  }
+  while (n-- > 0)
+    crc = _mm_crc32_u8(crc, *p++);
+  return ~crc;
+}
+
+int cksum_have_sse42(void)
+{
+  return __builtin_cpu_supports("sse4.2");
+}
+#else
+uint32_t cksum_crc32c_sse42(const struct pkt *packet)
+{
+  return cksum_crc32c_table(packet);
+}
+
+int cksum_have_sse42(void)
+{
+  return 0;
+}
+#endif
+
+/* CRC-32C through the fastest kernel this processor has */
+static uint32_t (*crc32c)(const struct pkt *);
+static pthread_once_t selectonce = PTHREAD_ONCE_INIT;
+
+static void crcselect(void)
+{
+  crc32c = cksum_have_sse42() ? cksum_crc32c_sse42 : cksum_crc32c_table;
+}
+
+int pkt_checksum(int kind, const struct pkt *packet)
+{
+  switch (kind) {
+  case CK_INET:
+    return (int)cksum_inet(packet);
+  case CK_CRC32C:
+    pthread_once(&selectonce, crcselect);
+    return (int)crc32c(packet);
+  default:
+    return (int)cksum_sum(packet);
+  }
+}
@@ -0,0 +1,35 @@
+/* Packet checksums.  Every kind covers the header and the payload,
+   everything but the checksum field itself, and is returned as the int
+   that goes in that field.
+
+     sum     the original one: seqnum + acknum + the payload bytes
+             (selective ACK included).  It cannot see bytes that are
+             swapped or moved, and does not cover the lengths.
+     inet    the Internet checksum (RFC 1071), the one's complement of the
+             one's complement sum of the 16-bit words.
+     crc32c  CRC-32C (Castagnoli).  Uses the SSE4.2 crc32 instruction when
+             the processor has it, found out at run time, and a table
+             otherwise. */
+#include <stdint.h>
+
+#define CK_SUM     0
+#define CK_INET    1
+#define CK_CRC32C  2
+
+/* look up a checksum by name; returns CK_*, or -1 if there is none */
+extern int checksumkind(const char *name);
+
+/* the name of checksum kind 'kind' */
+extern const char *checksumname(int kind);
+
+/* the checksum of the given kind of a packet */
+extern int pkt_checksum(int kind, const struct pkt *packet);
+
+/* the individual kernels, for benchmarking */
+extern uint32_t cksum_sum(const struct pkt *packet);
+extern uint32_t cksum_inet(const struct pkt *packet);
+extern uint32_t cksum_crc32c_table(const struct pkt *packet);
+extern uint32_t cksum_crc32c_sse42(const struct pkt *packet);
+
+/* whether cksum_crc32c_sse42 can run on this processor */
+extern int cksum_have_sse42(void);
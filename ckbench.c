@@ -0,0 +1,95 @@
+/* ******************************************************************
+   ckbench: time each packet checksum kernel and print the cost in
+   nanoseconds per packet.
+
+   usage: ckbench [packets [payload bytes]]
+**********************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "emulator.h"
+#include "checksum.h"
+
+#define NPKTS 1024              /* packets in the working set */
+
+int TRACE = 0;                  /* emulator.h declares it */
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(const char *name, uint32_t (*kernel)(const struct pkt *),
+                const struct pkt *pkts, long n)
+{
+  volatile uint32_t sink = 0;
+  uint32_t x = 0;
+  double t;
+  long i;
+
+  for (i = 0; i < NPKTS; i++)         /* warm up */
+    x += kernel(&pkts[i]);
+  t = now();
+  for (i = 0; i < n; i++)
+    x += kernel(&pkts[i % NPKTS]);
+  t = now() - t;
+  sink = x;
+  (void)sink;
+  printf("%-14s %8.2f ns/packet\n", name, t / n);
+}
+
+int main(int argc, char *argv[])
+{
+  struct pkt *pkts;
+  char *payloads;
+  long n = 20000000;
+  int size = 20;
+  int i, j;
+
+  if (argc > 1)
+    n = atol(argv[1]);
+  if (argc > 2)
+    size = atoi(argv[2]);
+  if (argc > 3 || n <= 0 || size < 0) {
+    fprintf(stderr, "usage: %s [packets [payload bytes]]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  pkts = malloc(NPKTS * sizeof(struct pkt));
+  payloads = malloc((size_t)NPKTS * size + 1);
+  if (pkts == NULL || payloads == NULL) {
+    printf("memory allocation for packets failed.");
+    return EXIT_FAILURE;
+  }
+  srand(1);
+  for (i = 0; i < NPKTS; i++) {
+    pkts[i].seqnum = rand();
+    pkts[i].acknum = rand();
+    pkts[i].checksum = 0;
+    pkts[i].length = size;
+    pkts[i].sacklen = 0;
+    pkts[i].payload = payloads + (size_t)i * size;
+    for (j = 0; j < size; j++)
+      pkts[i].payload[j] = 'a' + rand() % 26;
+  }
+
+  printf("%ld packets of %d bytes\n", n, size);
+  run("sum", cksum_sum, pkts, n);
+  run("inet", cksum_inet, pkts, n);
+  run("crc32c-table", cksum_crc32c_table, pkts, n);
+  if (cksum_have_sse42()) {
+    for (i = 0; i < NPKTS; i++)
+      if (cksum_crc32c_sse42(&pkts[i]) != cksum_crc32c_table(&pkts[i])) {
+        printf("crc32c-sse42 disagrees with crc32c-table\n");
+        return EXIT_FAILURE;
+      }
+    run("crc32c-sse42", cksum_crc32c_sse42, pkts, n);
+  }
+  else
+    printf("crc32c-sse42   not supported by this processor\n");
+  free(payloads);
+  free(pkts);
+  return EXIT_SUCCESS;
+}
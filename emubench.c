@@ -0,0 +1,353 @@
+/* ******************************************************************
+   emubench: benchmarks of the emulator core and of every protocol's hot
+   paths.  The micro benchmarks work on the emulator's internals
+   (the future event set, the timers, the channel), so this file
+   includes emulator.c instead of linking with emulator.o.
+
+   Micro benchmarks repeat one operation, doubling the count until a run
+   takes at least the benchmark time, and report the cost of one.  The
+   macro benchmarks run whole simulations of -n messages at 0%, 10% and
+   30% loss and report the wall time and the events simulated per second.
+   They use a message every 20 time units and the adaptive timeout, a
+   load both protocols carry without their timers firing early and the
+   channel filling up with resends.
+
+   Every result is one line in the format of Go's testing package,
+
+     Benchmark<name>   <iterations>   <value> <unit>   [<value> <unit> ...]
+
+   so the output of two versions can be compared with benchstat, or
+   with diff and a little awk.
+
+   usage: emubench [-n messages] [-t seconds] [-b substring]
+**********************************************************************/
+#include <time.h>
+#include <unistd.h>
+#include "emulator.c"
+#include "checksum.h"
+
+typedef double (*benchfn)(long n, int arg);  /* ns taken by n operations */
+
+static double benchtime = 0.5;  /* seconds a micro benchmark should run */
+static long long nmessages = 1000000;   /* messages in a macro run */
+static const char *pattern = "";        /* run benchmarks whose name has it */
+static const struct protocol *proto;    /* protocol being benchmarked */
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* a simulation with nothing scheduled, not even the first message */
+static struct sim *benchsim(int engine, double lossprob)
+{
+  struct simconfig cfg;
+  struct sim *s;
+  struct event *ev;
+
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.nsimmax = 0;
+  cfg.lossprob = lossprob;
+  cfg.corruptdirection = 2;
+  cfg.lambda = 10.0;
+  cfg.seed = 9999;
+  cfg.engine = engine;
+  cfg.proto.mss = 20;
+  cfg.proto.ackevery = 1;
+  s = newsim(&cfg);
+  while ((ev = s->emu->fes->popmin(s->emu)) != NULL)
+    freeevent(s->emu, ev);
+  return s;
+}
+
+/* take every event off the event set as the main loop would, without
+   handing any of them to the protocol */
+static void drain(struct sim *s)
+{
+  struct emu *e = s->emu;
+  struct event *ev;
+
+  while ((ev = e->fes->popmin(e)) != NULL) {
+    s->time = ev->evtime;
+    if (ev->evtype == FROM_LAYER3) {
+      e->chaninflight[ev->eventity]--;
+      pkt_free(s, ev->pkt);
+    }
+    else if (ev->evtype == TIMER_INTERRUPT)
+      e->timers[ev->eventity] = NULL;
+    freeevent(e, ev);
+  }
+}
+
+/* a cheap generator for event times, so the benchmark measures the event
+   set rather than the random number streams */
+static unsigned int lcg(unsigned int *x)
+{
+  *x = *x * 1664525u + 1013904223u;
+  return *x >> 8;
+}
+
+/* the hold model: with arg events pending, take the first one and put it
+   back a random distance into the future */
+static double bench_fes(long n, int arg, int engine)
+{
+  struct sim *s = benchsim(engine, 0.0);
+  struct emu *e = s->emu;
+  struct event *ev;
+  unsigned int x = 1;
+  double t;
+  long i;
+
+  for (i = 0; i < arg; i++) {
+    ev = allocevent(e);
+    ev->evtime = lcg(&x) % (unsigned int)arg;
+    ev->evtype = TIMER_INTERRUPT;
+    ev->eventity = A;
+    insertevent(s, ev);
+  }
+  t = now();
+  for (i = 0; i < n; i++) {
+    ev = e->fes->popmin(e);
+    s->time = ev->evtime;
+    ev->evtime = s->time + 1 + lcg(&x) % (unsigned int)arg;
+    insertevent(s, ev);
+  }
+  t = now() - t;
+  freesim(s);
+  return t;
+}
+
+static double bench_fes_heap(long n, int arg) { return bench_fes(n, arg, fesengine("heap")); }
+static double bench_fes_list(long n, int arg) { return bench_fes(n, arg, fesengine("list")); }
+
+/* start a timer, stop it and throw away its cancelled event, with arg
+   other events pending further on */
+static double bench_timer(long n, int arg)
+{
+  struct sim *s = benchsim(fesengine("heap"), 0.0);
+  struct emu *e = s->emu;
+  struct event *ev;
+  double t;
+  long i;
+
+  for (i = 0; i < arg; i++) {
+    ev = allocevent(e);
+    ev->evtime = 1e12 + i;
+    ev->evtype = TIMER_CANCELLED;
+    ev->eventity = B;
+    insertevent(s, ev);
+  }
+  t = now();
+  for (i = 0; i < n; i++) {
+    starttimer(s, A, 16.0);
+    stoptimer(s, A);
+    ev = e->fes->popmin(e);
+    s->time = ev->evtime;
+    freeevent(e, ev);
+  }
+  t = now() - t;
+  freesim(s);
+  return t;
+}
+
+/* send a packet into the channel and take its arrival off the event set;
+   arg is the loss probability in percent */
+static double bench_tolayer3(long n, int arg)
+{
+  struct sim *s = benchsim(fesengine("heap"), arg / 100.0);
+  struct pkt *p;
+  double t;
+  long i;
+
+  t = now();
+  for (i = 0; i < n; i++) {
+    p = pkt_alloc(s);
+    p->seqnum = (int)i;
+    p->acknum = -1;
+    p->length = s->config.mss;
+    p->checksum = 0;
+    tolayer3_send(s, A, p);
+    drain(s);
+  }
+  t = now() - t;
+  freesim(s);
+  return t;
+}
+
+/* the checksum of a full packet, of kind arg, as the protocols'
+   ComputeChecksum() works it out */
+static double bench_checksum(long n, int arg)
+{
+  struct sim *s = benchsim(fesengine("heap"), 0.0);
+  struct pkt *p = sim_allocpkts(s, 1);
+  volatile int sink;
+  int x = 0;
+  double t;
+  long i;
+
+  s->config.checksum = arg;
+  p->length = s->config.mss;
+  memset(p->payload, 'a', p->length);
+  t = now();
+  for (i = 0; i < n; i++) {
+    p->seqnum = (int)i;
+    x += pkt_checksum(s->config.checksum, p);
+  }
+  t = now() - t;
+  sink = x;
+  (void)sink;
+  freesim(s);
+  return t;
+}
+
+/* A_input with a window of arg packets: fill the window, then ACK its
+   packets one at a time.  Only the A_input calls are timed. */
+static double bench_ainput(long n, int arg)
+{
+  struct sim *s = benchsim(fesengine("heap"), 0.0);
+  struct pkt *ack = sim_allocpkts(s, 1);
+  struct msg msg;
+  char data[20];
+  long done, seq;
+  double t, t0;
+  int k;
+
+  s->config.windowsize = arg;
+  s->config.seqspace = 2 * arg;
+  proto->A_init(s);
+  memset(data, 'a', sizeof(data));
+  msg.data = data;
+  msg.length = sizeof(data);
+  ack->seqnum = -1;              /* an ACK alone, no data */
+  ack->length = 0;
+  t = 0.0;
+  seq = 0;
+  for (done = 0; done < n; ) {
+    for (k = 0; k < arg; k++)
+      proto->A_output(s, msg);
+    t0 = now();
+    for (k = 0; k < arg && done < n; k++, done++) {
+      ack->acknum = (int)(seq++ % (2 * arg));
+      ack->checksum = pkt_checksum(s->config.checksum, ack);
+      proto->A_input(s, ack);
+    }
+    t += now() - t0;
+    for (; k < arg; k++) {        /* ACK the rest, untimed */
+      ack->acknum = (int)(seq++ % (2 * arg));
+      ack->checksum = pkt_checksum(s->config.checksum, ack);
+      proto->A_input(s, ack);
+    }
+    drain(s);
+  }
+  freesim(s);
+  return t;
+}
+
+/* run a micro benchmark for at least benchtime seconds */
+static void micro(const char *name, benchfn fn, int arg)
+{
+  double t, goal = benchtime * 1e9;
+  long n = 1, next;
+
+  if (strstr(name, pattern) == NULL)
+    return;
+  for (;;) {
+    t = fn(n, arg);
+    if (t >= goal || n >= 1000000000L)
+      break;
+    /* aim 20% past the goal, at most 100 times as many, at least twice */
+    next = t > 0 ? (long)(1.2 * goal / t * n) : 100 * n;
+    if (next > 100 * n)
+      next = 100 * n;
+    if (next < 2 * n)
+      next = 2 * n;
+    n = next;
+  }
+  printf("Benchmark%-30s %12ld %12.1f ns/op\n", name, n, t / n);
+  fflush(stdout);
+}
+
+/* a whole simulation of nmessages messages at the given loss */
+static void macro(double loss)
+{
+  struct simconfig cfg;
+  struct simresult *res;
+  char name[64];
+  double t;
+
+  snprintf(name, sizeof(name), "Run/%s/loss=%g", proto->name, loss);
+  if (strstr(name, pattern) == NULL)
+    return;
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.protocol = protocolnum(proto->name);
+  cfg.nsimmax = nmessages;
+  cfg.lossprob = loss;
+  cfg.corruptdirection = 2;
+  cfg.lambda = 20.0;
+  cfg.seed = 9999;
+  cfg.proto.mss = 20;
+  cfg.proto.ackevery = 1;
+  cfg.proto.adaptive_rto = 1;
+  res = xmalloc(sizeof(struct simresult), "results");
+  t = now();
+  runsim(&cfg, res);
+  t = now() - t;
+  printf("Benchmark%-30s %12d %12.0f ns/op %12.0f events/s %12lld events %12lld delivered\n",
+         name, 1, t, res->events / (t / 1e9), res->events, res->messages_delivered);
+  fflush(stdout);
+  free(res);
+}
+
+int main(int argc, char *argv[])
+{
+  static const int fessizes[] = {16, 256, 4096};
+  static const int windows[] = {8, 64, 512};
+  char name[64];
+  int opt, i, j;
+
+  TRACE = 0;
+  while ((opt = getopt(argc, argv, "n:t:b:")) != -1) {
+    switch (opt) {
+    case 'n': nmessages = atoll(optarg); break;
+    case 't': benchtime = atof(optarg); break;
+    case 'b': pattern = optarg; break;
+    default:
+      fprintf(stderr, "usage: %s [-n messages] [-t seconds] [-b substring]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  printf("trace_max: %d\n", TRACE_MAX);
+  for (i = 0; i < 3; i++) {
+    snprintf(name, sizeof(name), "FES/heap/pending=%d", fessizes[i]);
+    micro(name, bench_fes_heap, fessizes[i]);
+  }
+  for (i = 0; i < 3; i++) {
+    snprintf(name, sizeof(name), "FES/list/pending=%d", fessizes[i]);
+    micro(name, bench_fes_list, fessizes[i]);
+  }
+  micro("Timer/pending=64", bench_timer, 64);
+  micro("ToLayer3/loss=0", bench_tolayer3, 0);
+  micro("ToLayer3/loss=10", bench_tolayer3, 10);
+  for (i = CK_SUM; i <= CK_CRC32C; i++) {
+    snprintf(name, sizeof(name), "ComputeChecksum/%s", checksumname(i));
+    micro(name, bench_checksum, i);
+  }
+  for (j = 0; protocols[j] != NULL; j++) {
+    proto = protocols[j];
+    for (i = 0; i < 3; i++) {
+      snprintf(name, sizeof(name), "AInput/%s/window=%d", proto->name, windows[i]);
+      micro(name, bench_ainput, windows[i]);
+    }
+  }
+  for (j = 0; protocols[j] != NULL && nmessages > 0; j++) {
+    proto = protocols[j];
+    macro(0.0);
+    macro(0.1);
+    macro(0.3);
+  }
+  return EXIT_SUCCESS;
+}
@@ -36,85 +36,513 @@
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "emulator.h"
 #include "gbn.h"
+#include "sr.h"
+#include "sim.h"
+#include "rng.h"
+#include "trace.h"
 
 struct event {
-  float evtime;           /* event time */
+  double evtime;          /* event time */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
-  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
-  struct event *next;
+  struct pkt *pkt;        /* packet (if any) assoc w/ this event */
+  unsigned long long evseq; /* insertion order, breaks ties between equal times */
+  struct event *prev;     /* neighbours (list engine only) */
+  struct event *next;     /* also links the pool's free list */
 };
 
-struct event *evlist = NULL;   /* the event list */
+/* The future event set.  Every engine keeps events ordered by evtime.
+   Among equal times the most recently inserted event comes first, which
+   is the order the original sorted list produced (a new event was placed
+   in front of any event with the same time); evseq records insertion
+   order so the heap can reproduce it exactly.  walk() visits the pending
+   events in no particular order. */
+struct emu;
+
+struct fes {
+  const char *name;
+  void (*insert)(struct emu *, struct event *);
+  struct event *(*popmin)(struct emu *);
+  void (*walk)(struct emu *, void (*visit)(struct event *, void *), void *arg);
+};
+
+/* Events are carved out of slabs and recycled through a free list
+   instead of going through malloc()/free() each time.  Slabs are only
+   released with the simulation, so the pool grows to the peak number of
+   pending events, which is reported at the end of the run. */
+#define EVSLAB 256               /* events per slab */
+
+struct evslab {
+  struct evslab *next;
+  struct event ev[EVSLAB];
+};
+
+/* Packets have a pool of their own, kept the same way, so that events
+   stay small: only the packets in flight and those the protocols hold
+   from pkt_alloc() take a payload buffer of pktroom bytes.  The slabs are
+   smaller, as a buffer can be 64 KB. */
+#define PKTSLAB 32               /* packets per slab */
+
+struct pktbuf {
+  struct pkt pkt;                /* first, so a packet is its buffer */
+  struct pktbuf *next;           /* links the pool's free list */
+};
+
+struct pktslab {
+  struct pktslab *next;
+  char *payloads;                /* PKTSLAB buffers of pktroom bytes */
+  struct pktbuf buf[PKTSLAB];
+};
+
+/* The link model (see struct linkconfig in sim.h).  The queue is kept as
+   the times at which its packets finish being sent, in a ring that grows
+   if the queue has no limit; packets that have finished are let go
+   lazily, when the link is next used, and the integral of the queue
+   length over time is brought up to date as they are. */
+
+struct link {
+  double rate, delay;
+  int cap;                       /* queue limit, 0 = none */
+  double *finish;                /* ring of finish times ... */
+  int first, n, size;            /* ... its head, length and size */
+  double busyuntil;              /* when the last packet queued is sent */
+  double since;                  /* time area is up to */
+  double area;                   /* integral of n over time */
+  double busy;                   /* total time spent sending */
+  int peak;
+  long long drops;
+};
+
+/* A loss trace (see struct lossconfig in sim.h), mapped into memory and
+   read a line at a time.  The pages are only touched as the simulation
+   gets to them, and those it has left TRACEDROP bytes behind are handed
+   back to the kernel, so a trace of any size streams through a small
+   amount of memory. */
+#define TRACEDROP (1 << 20)      /* a multiple of the page size */
+
+struct losstrace {
+  const char *path;
+  const char *data;              /* the mapped file ... */
+  size_t size;                   /* ... its size ... */
+  size_t pos;                    /* ... the start of the next line ... */
+  size_t kept;                   /* ... and of the pages still wanted */
+  long long records;             /* packets replayed */
+};
+
+/* Arrival times of the messages a protocol entity has accepted from
+   layer 5 and not yet delivered.  The protocols deliver in order, so a
+   message delivered at one side is the oldest one accepted at the other. */
+struct stamps {
+  double *t;                     /* ring of arrival times ... */
+  int first, n, size;            /* ... its head, length and size */
+};
+
+/* Every random decision draws from its own stream so that changing one
+   model (say the loss probability) does not shift the numbers seen by the
+   others.  The channel has streams of its own for each direction, so
+   the nth packet A sends is lost, corrupted and delayed alike whichever
+   protocol sent it and however many packets B sent meanwhile: runs of
+   different protocols with the same seed see common random numbers.
+   (Tail drops at a link queue depend on the traffic and are not common
+   to them, but a dropped packet still takes its numbers, so the packets
+   after it get the ones they would have had.)
+   The streams of one simulation are 2^128 draws apart, and each
+   replication of a seed starts 2^192 draws further on.  Uniforms are
+   generated RNG_BATCH at a time; the sequence is the same either way. */
+#define RNG_ARRIVAL   0          /* message arrivals from layer 5 */
+#define RNG_MSGSIZE   1          /* message sizes */
+#define RNG_LOSS      2          /* packet loss, + the sending entity */
+#define RNG_CORRUPT   4          /* packet corruption, + the sending entity */
+#define RNG_DELAY     6          /* channel delay, + the sending entity */
+#define NSTREAMS      8
+
+#ifndef RNG_BATCH
+#define RNG_BATCH     64
+#endif
+
+struct stream {
+  struct rng rng;
+  int next;                      /* next unused entry of buf */
+  double buf[RNG_BATCH];
+};
+
+/* memory handed out by sim_alloc(), released with the simulation */
+union simblock {
+  union simblock *next;
+  long double align;             /* keep the block after it aligned */
+  void *p;
+  long long ll;
+};
+
+/* everything the emulator knows about one simulation */
+struct emu {
+  const struct fes *fes;         /* future event set engine */
+  struct event *evlist;          /* list engine: the event list */
+  struct event **heap;           /* heap engine: the heap */
+  int heapsize;                  /* number of events in the heap */
+  int heapcap;                   /* allocated slots */
+  unsigned long long nextseq;    /* evseq of the next inserted event */
+
+  /* pending timer event of each entity, NULL if its timer is not running.
+     Stopping a timer only marks its event TIMER_CANCELLED; the main loop
+     drops it when it reaches the head of the event set, so neither
+     starttimer() nor stoptimer() has to search for it. */
+  struct event *timers[2];
+
+  /* state of the channel towards each entity (indexed by destination):
+     the number of packets scheduled to arrive there and the arrival time
+     of the most recently scheduled one.  Arrivals are scheduled in
+     increasing time order, so that is also the latest pending arrival. */
+  int   chaninflight[2];
+  double chantail[2];
+
+  struct link link[2];           /* links from A and from B (by source) */
+  struct stamps born[2];         /* messages accepted at A and at B */
+
+  struct evslab *evslabs;        /* all slabs allocated so far */
+  struct event *evfree;          /* free list of events */
+  int nevslabs;                  /* number of slabs allocated */
+  int evinuse;                   /* events currently handed out */
+  int evpeak;                    /* high-water mark of evinuse */
+  struct pktslab *pktslabs;      /* the packet pool, likewise */
+  struct pktbuf *pktfree;
+  int npktslabs;
+  int pktinuse;
+  int pktpeak;
+  long long nevents;             /* events simulated, stopped timers left out */
+  union simblock *blocks;        /* sim_alloc() allocations */
+
+  struct stream streams[NSTREAMS]; /* random number streams */
+  struct tracelog *log;          /* binary event log, or NULL */
+
+  long long nsim;                /* number of messages from 5 to 4 so far */
+  long long nsimmax;             /* number of msgs to generate, then stop */
+  double lossprob;               /* probability that a packet is dropped  */
+  struct lossconfig loss;        /* loss model */
+  int bad[2];                    /* gilbert: each direction in its bad state */
+  int lastlost[2];               /* the last packet each way was lost */
+  struct losstrace trace[2];     /* trace: packets from A and from B */
+  double corruptprob;      /* probability that one bit is packet is flipped */
+  int corruptdirection;    /* A->B A<-B or bidirectional corruption/loss */
+  double lambda;           /* arrival rate of messages from layer 5 */
+  int mss;                 /* payload bytes a packet can carry */
+  int pktroom;             /* bytes of a packet buffer, mss + sackroom */
+  int msgmin, msgmax;      /* message sizes from layer 5 */
+  char *msgbuf;            /* data of the message being handed to layer 4 */
+
+  /* statistics updated by emulator */
+  long long messages_delivered;
+  long long ntolayer3;           /* number sent into layer 3 */
+  long long nlost;               /* number lost in media */
+  long long ncorrupt;            /* number corrupted by media*/
+  long long lossbursts;          /* runs of packets lost in a row */
+  long long bytes_fromlayer5;    /* message bytes given to layer 4 */
+  long long bytes_tolayer3;      /* payload bytes sent into layer 3 */
+  long long bytes_delivered;     /* bytes delivered to layer 5 */
+  long long bytes_wire;          /* bytes sent, headers included */
+  long long latn;                /* latencies measured ... */
+  double latsum, latmin, latmax; /* ... their sum and range ... */
+  long long lathist[LATBUCKETS]; /* ... and histogram */
+};
 
 /* possible events: */
 #define  TIMER_INTERRUPT 0  
 #define  FROM_LAYER5     1
 #define  FROM_LAYER3     2
+#define  TIMER_CANCELLED 3   /* stopped timer, discarded when it comes due */
 
 #define  OFF             0
 #define  ON              1
 
+/* Only read while simulations run, so it is shared by all of them. */
 int TRACE = 3;
 
-/* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
-
-/* statistics updated by emulator */
-static int packets_lost;  
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
-static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
-static float lossprob;            /* probability that a packet is dropped  */
-static float corruptprob;   /* probability that one bit is packet is flipped */
-static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
-static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
+#define TRACELOG_RING 4096   /* records buffered before writing the log */
+
+/* append a record to the binary event log, if there is one */
+#define LOGEVENT(s, type, entity, seq, ack, check, value)                 \
+  do {                                                                  \
+    if (TRACE_MAX >= 1 && (s)->emu->log != NULL)                        \
+      tracelog_put((s)->emu->log, type, entity, (s)->time, seq, ack,    \
+                   check, value);                                       \
+  } while (0)
+
+static void *xmalloc(size_t size, const char *what)
+{
+  void *p = malloc(size);
+
+  if (p == NULL) {
+    printf("memory allocation for %s failed.", what);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void link_init(struct link *l, const struct linkconfig *cfg)
+{
+  l->rate = cfg->rate;
+  l->delay = cfg->delay;
+  l->cap = cfg->queue;
+  l->size = l->cap > 0 ? l->cap : 64;
+  l->finish = l->rate > 0 ? xmalloc(l->size * sizeof(double), "link queue") : NULL;
+}
+
+/* let go of the packets sent by time t */
+static void link_advance(struct link *l, double t)
+{
+  while (l->n > 0 && l->finish[l->first] <= t) {
+    l->area += l->n * (l->finish[l->first] - l->since);
+    l->since = l->finish[l->first];
+    l->first = (l->first + 1) % l->size;
+    l->n--;
+  }
+  l->area += l->n * (t - l->since);
+  l->since = t;
+}
+
+/* queue a packet of 'bytes' bytes at time t.  Returns its arrival time
+   at the other end, or -1 if the queue is full. */
+static double link_send(struct link *l, int bytes, double t)
+{
+  double *finish;
+  double start;
+  int i;
+
+  link_advance(l, t);
+  if (l->cap > 0 && l->n == l->cap) {
+    l->drops++;
+    return -1.0;
+  }
+  if (l->n == l->size) {
+    finish = xmalloc(2 * l->size * sizeof(double), "link queue");
+    for (i = 0; i < l->n; i++)
+      finish[i] = l->finish[(l->first + i) % l->size];
+    free(l->finish);
+    l->finish = finish;
+    l->first = 0;
+    l->size *= 2;
+  }
+  start = l->busyuntil > t ? l->busyuntil : t;
+  l->busyuntil = start + 8.0 * bytes / l->rate;
+  l->busy += l->busyuntil - start;
+  l->finish[(l->first + l->n) % l->size] = l->busyuntil;
+  if (++l->n > l->peak)
+    l->peak = l->n;
+  return l->busyuntil + l->delay;
+}
+
+static void losstrace_open(struct losstrace *t, const char *path)
+{
+  struct stat st;
+  void *data;
+  int fd;
+
+  t->path = path;
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  if (st.st_size == 0) {
+    printf("%s: loss trace is empty\n", path);
+    exit(EXIT_FAILURE);
+  }
+  data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+  t->data = data;
+  t->size = (size_t)st.st_size;
+}
+
+static void losstrace_close(struct losstrace *t)
+{
+  if (t->data != NULL)
+    munmap((void *)t->data, t->size);
+}
+
+/* the next packet of a loss trace: returns whether it was lost, and its
+   delay in *delay if it was not */
+static int losstrace_next(struct losstrace *t, double *delay)
+{
+  char buf[64];
+  const char *line, *end, *c;
+  char *stop;
+  size_t n;
+
+  for (;;) {
+    if (t->pos == t->size) {
+      if (t->records == 0) {
+        printf("%s: loss trace has no packets\n", t->path);
+        exit(EXIT_FAILURE);
+      }
+      t->pos = 0;               /* start again from the top */
+      t->kept = 0;
+    }
+    if (t->pos - t->kept >= 2 * TRACEDROP) {
+      madvise((void *)(t->data + t->kept), TRACEDROP, MADV_DONTNEED);
+      t->kept += TRACEDROP;
+    }
+    line = t->data + t->pos;
+    end = memchr(line, '\n', t->size - t->pos);
+    if (end == NULL)
+      end = t->data + t->size;
+    t->pos = end - t->data + (end < t->data + t->size);
+    if ((c = memchr(line, '#', end - line)) != NULL)
+      end = c;
+    while (line < end && (*line == ' ' || *line == '\t'))
+      line++;
+    while (end > line && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+      end--;
+    if (line == end)
+      continue;
+    t->records++;
+    n = end - line;
+    if (n == 1 && *line == '-')
+      return 1;
+    if (n < sizeof(buf)) {
+      memcpy(buf, line, n);
+      buf[n] = '\0';
+      *delay = strtod(buf, &stop);
+      if (stop != buf && *stop == '\0' && *delay >= 0)
+        return 0;
+    }
+    printf("%s: bad loss trace line '%.*s'\n", t->path, (int)n, line);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void stamps_push(struct stamps *q, double t)
+{
+  double *ring;
+  int i;
+
+  if (q->n == q->size) {
+    ring = xmalloc((q->size > 0 ? 2 * q->size : 64) * sizeof(double), "message times");
+    for (i = 0; i < q->n; i++)
+      ring[i] = q->t[(q->first + i) % q->size];
+    free(q->t);
+    q->t = ring;
+    q->first = 0;
+    q->size = q->size > 0 ? 2 * q->size : 64;
+  }
+  q->t[(q->first + q->n) % q->size] = t;
+  q->n++;
+}
+
+static double stamps_pop(struct stamps *q)
+{
+  double t = q->t[q->first];
+
+  q->first = (q->first + 1) % q->size;
+  q->n--;
+  return t;
+}
+
+/* upper end of latency bucket i (see sim.h) */
+double latbound(int i)
+{
+  return ldexp(1.0 + (double)(i % LATSUB) / LATSUB, LATEXPMIN + i / LATSUB);
+}
+
+/* the first bucket whose upper end is at least x */
+static int latbucket(double x)
+{
+  double f;
+  int exp, i, k;
+
+  if (x <= 0.0)
+    return 0;
+  f = (2.0 * frexp(x, &exp) - 1.0) * LATSUB;   /* x = (1 + f/LATSUB) 2^(exp-1) */
+  k = (int)f;
+  if (k < f)
+    k++;
+  i = (exp - 1 - LATEXPMIN) * LATSUB + k;
+  if (i < 0)
+    return 0;
+  return i < LATBUCKETS ? i : LATBUCKETS - 1;
+}
+
+/* the latency below which a fraction q of the measured ones lie */
+static double latpercentile(const struct emu *e, double q)
+{
+  long long rank, seen;
+  double x;
+  int i;
+
+  rank = (long long)ceil(q * e->latn);
+  if (rank < 1)
+    rank = 1;
+  seen = 0;
+  for (i = 0; i < LATBUCKETS - 1; i++) {
+    seen += e->lathist[i];
+    if (seen >= rank)
+      break;
+  }
+  x = latbound(i);
+  return x < e->latmax ? x : e->latmax;
+}
 
 /****************************************************************************/
-/* jimsrand(): return a double in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
+/* jimsrand(): return a double in range [0,1).  The routine below is used to */
+/* isolate all random number generation in one location.  Each simulation    */
+/* draws from its own streams, one per kind of random decision.             */
 /****************************************************************************/
-double jimsrand(void) 
+double jimsrand(struct sim *s, int stream) 
 {
-  double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
+  struct stream *st = &s->emu->streams[stream];
   double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
-  if (TRACE > 3)
+
+  if (st->next == RNG_BATCH) {
+    rng_fill(&st->rng, st->buf, RNG_BATCH);
+    st->next = 0;
+  }
+  x = st->buf[st->next++];   /* x should be uniform in [0,1) */
+  if (TRACE_ABOVE(3))
     printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
 }  
 
+/* seed the streams of a simulation */
+static void seedstreams(struct emu *e, uint64_t seed, int replication)
+{
+  struct rng r;
+  int i;
+
+  rng_seed(&r, seed);
+  for (i = 0; i < replication; i++)
+    rng_longjump(&r);
+  for (i = 0; i < NSTREAMS; i++) {
+    e->streams[i].rng = r;
+    e->streams[i].next = RNG_BATCH;
+    rng_jump(&r);
+  }
+}
+
 /********************* EVENT HANDLINE ROUTINES *******/
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
-void insertevent(struct event *p)
+/* list engine: the original sorted doubly linked list.  O(n) insert,
+   O(1) pop.  Kept as a reference and for tiny event sets. */
+static void list_insert(struct emu *e, struct event *p)
 {
   struct event *q,*qold;
 
-  if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
-  }
-  q = evlist;     /* q points to front of list in which p struct inserted */
+  q = e->evlist;  /* q points to front of list in which p struct inserted */
   if (q==NULL) {   /* list is empty */
-    evlist=p;
+    e->evlist=p;
     p->next=NULL;
     p->prev=NULL;
   }
@@ -126,11 +554,11 @@ void insertevent(struct event *p)
       p->prev = qold;
       p->next = NULL;
     }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
+    else if (q==e->evlist) { /* front of list */
+      p->next=e->evlist;
       p->prev=NULL;
       p->next->prev=p;
-      evlist = p;
+      e->evlist = p;
     }
     else {     /* middle of list */
       p->next=q;
@@ -141,274 +569,672 @@ void insertevent(struct event *p)
   }
 }
 
-void generate_next_arrival(void)
+static struct event *list_popmin(struct emu *e)
+{
+  struct event *q = e->evlist;
+
+  if (q != NULL) {
+    e->evlist = q->next;
+    if (e->evlist != NULL)
+      e->evlist->prev = NULL;
+  }
+  return q;
+}
+
+static void list_walk(struct emu *e, void (*visit)(struct event *, void *), void *arg)
+{
+  struct event *q;
+
+  for (q = e->evlist; q != NULL; q = q->next)
+    visit(q, arg);
+}
+
+static const struct fes fes_list = {
+  "list", list_insert, list_popmin, list_walk
+};
+
+/* heap engine: binary min-heap keyed on (evtime, -evseq).  O(log n) insert
+   and pop. */
+static int evbefore(const struct event *p, const struct event *q)
+{
+  if (p->evtime != q->evtime)
+    return p->evtime < q->evtime;
+  return p->evseq > q->evseq;
+}
+
+static void heap_siftup(struct emu *e, int i)
+{
+  struct event *p = e->heap[i];
+  int parent;
+
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (!evbefore(p, e->heap[parent]))
+      break;
+    e->heap[i] = e->heap[parent];
+    i = parent;
+  }
+  e->heap[i] = p;
+}
+
+static void heap_siftdown(struct emu *e, int i)
+{
+  struct event *p = e->heap[i];
+  int child;
+
+  while ((child = 2*i + 1) < e->heapsize) {
+    if (child + 1 < e->heapsize && evbefore(e->heap[child+1], e->heap[child]))
+      child++;
+    if (!evbefore(e->heap[child], p))
+      break;
+    e->heap[i] = e->heap[child];
+    i = child;
+  }
+  e->heap[i] = p;
+}
+
+static void heap_insert(struct emu *e, struct event *p)
+{
+  if (e->heapsize == e->heapcap) {
+    e->heapcap = e->heapcap ? 2*e->heapcap : 64;
+    e->heap = realloc(e->heap, e->heapcap * sizeof(struct event *));
+    if (e->heap == NULL) {
+      printf("memory allocation for event heap failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  e->heap[e->heapsize] = p;
+  heap_siftup(e, e->heapsize++);
+}
+
+static struct event *heap_popmin(struct emu *e)
+{
+  struct event *p;
+
+  if (e->heapsize == 0)
+    return NULL;
+  p = e->heap[0];
+  if (--e->heapsize > 0) {
+    e->heap[0] = e->heap[e->heapsize];
+    heap_siftdown(e, 0);
+  }
+  return p;
+}
+
+static void heap_walk(struct emu *e, void (*visit)(struct event *, void *), void *arg)
+{
+  int i;
+
+  for (i = 0; i < e->heapsize; i++)
+    visit(e->heap[i], arg);
+}
+
+static const struct fes fes_heap = {
+  "heap", heap_insert, heap_popmin, heap_walk
+};
+
+static const struct fes *fes_engines[] = { &fes_heap, &fes_list, NULL };
+
+int fesengine(const char *name)
+{
+  int i;
+
+  for (i = 0; fes_engines[i] != NULL; i++)
+    if (strcmp(fes_engines[i]->name, name) == 0)
+      return i;
+  return -1;
+}
+
+/* every protocol linked in; a new one only needs adding here */
+static const struct protocol *protocols[] = { &gbn_protocol, &sr_protocol, NULL };
+
+int protocolnum(const char *name)
+{
+  int i;
+
+  for (i = 0; protocols[i] != NULL; i++)
+    if (strcmp(protocols[i]->name, name) == 0)
+      return i;
+  return -1;
+}
+
+const char *protocolname(int num)
+{
+  return protocols[num]->name;
+}
+
+void insertevent(struct sim *s, struct event *p)
+{
+  if (TRACE_ABOVE(2)) {
+    printf("            INSERTEVENT: time is %f\n",s->time);
+    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+  }
+  p->evseq = s->emu->nextseq++;
+  s->emu->fes->insert(s->emu, p);
+}
+
+static struct event *allocevent(struct emu *e)
+{
+  struct evslab *slab;
+  struct event *evptr;
+  int i;
+
+  if (e->evfree == NULL) {
+    slab = xmalloc(sizeof(struct evslab), "event");
+    slab->next = e->evslabs;
+    e->evslabs = slab;
+    e->nevslabs++;
+    for (i = EVSLAB - 1; i >= 0; i--) {
+      slab->ev[i].next = e->evfree;
+      e->evfree = &slab->ev[i];
+    }
+  }
+  evptr = e->evfree;
+  e->evfree = evptr->next;
+  if (++e->evinuse > e->evpeak)
+    e->evpeak = e->evinuse;
+  return evptr;
+}
+
+static void freeevent(struct emu *e, struct event *evptr)
+{
+  evptr->next = e->evfree;
+  e->evfree = evptr;
+  e->evinuse--;
+}
+
+void generate_next_arrival(struct sim *s)
 {
   double x;
   struct event *evptr;
 
-  if (TRACE>2)
+  if (TRACE_ABOVE(2))
     printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
+  x = s->emu->lambda*jimsrand(s, RNG_ARRIVAL)*2;  /* x is uniform on [0,2*lambda] */
   /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + x;
+  evptr = allocevent(s->emu);
+  evptr->evtime =  s->time + x;
   evptr->evtype =  FROM_LAYER5;
-  if (BIDIRECTIONAL && (jimsrand()>0.5) )
+  if (s->config.bidirectional && (jimsrand(s, RNG_ARRIVAL)>0.5) )
     evptr->eventity = B;
   else
     evptr->eventity = A;
-  insertevent(evptr);
+  insertevent(s, evptr);
 } 
 
-void printevlist(void)
+struct evarray {
+  struct event **ev;
+  int n;
+};
+
+static void collectevent(struct event *q, void *arg)
 {
-  struct event *q;
+  struct evarray *a = arg;
+
+  if (q->evtype != TIMER_CANCELLED)
+    a->ev[a->n++] = q;
+}
+
+static int cmpevent(const void *x, const void *y)
+{
+  const struct event *p = *(struct event * const *)x;
+  const struct event *q = *(struct event * const *)y;
+
+  return evbefore(p, q) ? -1 : evbefore(q, p);
+}
+
+static void countevent(struct event *q, void *arg)
+{
+  (void)q;
+  (*(int *)arg)++;
+}
+
+void printevlist(struct sim *s)
+{
+  struct emu *e = s->emu;
+  struct evarray a;
+  int i, n = 0;
+
+  e->fes->walk(e, countevent, &n);
+  a.ev = xmalloc((n ? n : 1) * sizeof(struct event *), "event list");
+  a.n = 0;
+  e->fes->walk(e, collectevent, &a);
+  qsort(a.ev, a.n, sizeof(struct event *), cmpevent);
   printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+  for (i = 0; i < a.n; i++) {
+    printf("Event time: %f, type: %d entity: %d\n",a.ev[i]->evtime,a.ev[i]->evtype,a.ev[i]->eventity);
   }
   printf("--------------\n");
+  free(a.ev);
 }
 
-void init(void)                         /* initialize the simulator */
+/* set up a fresh simulation */
+static struct sim *newsim(const struct simconfig *cfg)
 {
-  float sum, avg;
-  int i;
+  struct sim *s;
+  struct emu *e;
 
-  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
-  printf("Enter the number of messages to simulate: ");
-  scanf("%d",&nsimmax);
-  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f",&lossprob);
-  printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f",&corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0) {
-    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
-    scanf("%d",&corruptdirection);
-  }
-  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f",&lambda);
-  printf("Enter TRACE:");
-  scanf("%d",&TRACE);
-
-
-  srand(9999);              /* init random number generator */
-  sum = 0.0;                /* test random number generator for students */
-  for (i=0; i<1000; i++)
-    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
-  avg = sum/1000.0;
-  if (avg < 0.25 || avg > 0.75) {
-    printf("It is likely that random number generation on your machine\n" ); 
-    printf("is different from what this emulator expects.  Please take\n");
-    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
+  s = xmalloc(sizeof(struct sim), "simulation");
+  e = xmalloc(sizeof(struct emu), "simulation");
+  memset(s, 0, sizeof(struct sim));
+  memset(e, 0, sizeof(struct emu));
+  s->emu = e;
+  e->fes = fes_engines[cfg->engine];
+
+  e->nsimmax = cfg->nsimmax;
+  e->lossprob = cfg->lossprob;
+  e->loss = cfg->loss;
+  if (e->loss.model == LOSS_TRACE) {
+    losstrace_open(&e->trace[A], e->loss.trace[A]);
+    losstrace_open(&e->trace[B], e->loss.trace[B]);
+  }
+  e->corruptprob = cfg->corruptprob;
+  e->corruptdirection = cfg->corruptdirection;
+  e->lambda = cfg->lambda;
+  s->config = cfg->proto;
+  if (s->config.mss <= 0)
+    s->config.mss = 20;
+  e->mss = s->config.mss;
+  s->config.sackroom = ((s->config.windowsize > 0 ? s->config.windowsize : 64) + 7) / 8;
+  e->pktroom = e->mss + s->config.sackroom;
+  e->msgmin = cfg->msgmin > 0 ? cfg->msgmin : e->mss;
+  e->msgmax = cfg->msgmax > 0 ? cfg->msgmax : e->mss;
+  if (e->msgmin > e->msgmax || e->msgmax > e->mss) {
+    printf("message sizes %d to %d do not fit in a %d byte segment\n",
+           e->msgmin, e->msgmax, e->mss);
     exit(EXIT_FAILURE);
   }
+  e->msgbuf = xmalloc(e->mss, "message");
+  link_init(&e->link[A], &cfg->link[A]);
+  link_init(&e->link[B], &cfg->link[B]);
+
+  seedstreams(e, cfg->seed, cfg->replication);
+  if (TRACE_MAX >= 1 && cfg->logfile != NULL) {
+    e->log = tracelog_open(cfg->logfile, TRACELOG_RING);
+    if (e->log == NULL) {
+      perror(cfg->logfile);
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;  
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
+  s->time=0.0;                 /* initialize time to 0.0 */
+  generate_next_arrival(s);    /* initialize event list */
+  return s;
+}
 
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
+static void freesim(struct sim *s)
+{
+  struct emu *e = s->emu;
+  struct evslab *slab;
+  struct pktslab *pslab;
+  union simblock *b;
 
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+  if (e->log != NULL)
+    tracelog_close(e->log);
+  while ((slab = e->evslabs) != NULL) {
+    e->evslabs = slab->next;
+    free(slab);
+  }
+  while ((pslab = e->pktslabs) != NULL) {
+    e->pktslabs = pslab->next;
+    free(pslab->payloads);
+    free(pslab);
+  }
+  while ((b = e->blocks) != NULL) {
+    e->blocks = b->next;
+    free(b);
+  }
+  free(e->heap);
+  free(e->msgbuf);
+  free(e->link[A].finish);
+  free(e->link[B].finish);
+  free(e->born[A].t);
+  free(e->born[B].t);
+  losstrace_close(&e->trace[A]);
+  losstrace_close(&e->trace[B]);
+  free(e);
+  free(s);
 }
 
 /********************** Student-callable ROUTINES ***********************/
 
+/* allocate zeroed memory that lives as long as the simulation */
+void *sim_alloc(struct sim *s, size_t size)
+{
+  union simblock *b;
+
+  b = xmalloc(sizeof(union simblock) + size, "protocol state");
+  memset(b + 1, 0, size);
+  b->next = s->emu->blocks;
+  s->emu->blocks = b;
+  return b + 1;
+}
+
+struct pkt *sim_allocpkts(struct sim *s, int n)
+{
+  struct pkt *p = sim_alloc(s, n * sizeof(struct pkt));
+  char *payloads = sim_alloc(s, (size_t)n * s->emu->pktroom);
+  int i;
+
+  for (i = 0; i < n; i++)
+    p[i].payload = payloads + (size_t)i * s->emu->pktroom;
+  return p;
+}
+
 /* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB)
+void stoptimer(struct sim *s, int AorB)
 /* A or B is trying to stop timer */
 {
   struct event *q;
 
-  if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
+  if (TRACE_ABOVE(1))
+    printf("          STOP TIMER: stopping timer at %f\n",s->time);
+  q = s->emu->timers[AorB];
+  if (q != NULL) {
+    LOGEVENT(s, TR_STOPTIMER, AorB, -1, -1, 0, 0.0);
+    q->evtype = TIMER_CANCELLED;
+    s->emu->timers[AorB] = NULL;
+    return;
+  }
   printf("Warning: unable to cancel your timer. It wasn't running.\n");
 }
 
 
-void starttimer(int AorB, double increment)
+void starttimer(struct sim *s, int AorB, double increment)
 /* A or B is trying to start timer */
 {
 
-  struct event *q;
   struct event *evptr;
 
-  if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
+  if (TRACE_ABOVE(1))
+    printf("          START TIMER: starting timer at %f\n",s->time);
   /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
+  if (s->emu->timers[AorB] != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
  
   /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + increment;
+  evptr = allocevent(s->emu);
+  evptr->evtime =  s->time + increment;
   evptr->evtype =  TIMER_INTERRUPT;
    
  
   evptr->eventity = AorB;
-  insertevent(evptr);
+  s->emu->timers[AorB] = evptr;
+  LOGEVENT(s, TR_STARTTIMER, AorB, -1, -1, 0, increment);
+  insertevent(s, evptr);
 } 
 
 
 /************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
-/* A or B is sending to network  */
+/* A packet is sent by scheduling an event that points to it: nothing is
+   copied.  The main loop frees it once the receiver has seen it. */
+struct pkt *pkt_alloc(struct sim *s)
 {
-  struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
+  struct emu *e = s->emu;
+  struct pktslab *slab;
+  struct pktbuf *b;
   int i;
 
-  ntolayer3++;
+  if (e->pktfree == NULL) {
+    slab = xmalloc(sizeof(struct pktslab), "packet");
+    slab->payloads = xmalloc((size_t)PKTSLAB * e->pktroom, "packet buffer");
+    slab->next = e->pktslabs;
+    e->pktslabs = slab;
+    e->npktslabs++;
+    for (i = PKTSLAB - 1; i >= 0; i--) {
+      slab->buf[i].pkt.payload = slab->payloads + (size_t)i * e->pktroom;
+      slab->buf[i].next = e->pktfree;
+      e->pktfree = &slab->buf[i];
+    }
+  }
+  b = e->pktfree;
+  e->pktfree = b->next;
+  if (++e->pktinuse > e->pktpeak)
+    e->pktpeak = e->pktinuse;
+  b->pkt.length = 0;
+  b->pkt.sacklen = 0;
+  return &b->pkt;
+}
+
+void pkt_free(struct sim *s, struct pkt *packet)
+{
+  struct emu *e = s->emu;
+  struct pktbuf *b = (struct pktbuf *)packet;
+
+  b->next = e->pktfree;
+  e->pktfree = b;
+  e->pktinuse--;
+}
+
+void pkt_copy(struct pkt *dst, const struct pkt *src)
+{
+  dst->seqnum = src->seqnum;
+  dst->acknum = src->acknum;
+  dst->checksum = src->checksum;
+  dst->length = src->length;
+  dst->sacklen = src->sacklen;
+  memcpy(dst->payload, src->payload, src->length + src->sacklen);
+}
+
+void tolayer3(struct sim *s, int AorB, struct pkt packet)
+/* A or B is sending to network, by value: copy into a buffer of our own */
+{
+  struct pkt *mypktptr = pkt_alloc(s);
+
+  pkt_copy(mypktptr, &packet);
+  tolayer3_send(s, AorB, mypktptr);
+}
+
+/* whether the channel loses the next packet from A or B (AorB).  Every
+   packet takes the same random numbers, lost or not, even where losses
+   do not apply (see corruptdirection); a trace only gives up a line for a
+   packet it applies to.  A loss trace also gives the packet's delay, in
+   *delay; otherwise it is left alone. */
+static int packetlost(struct sim *s, int AorB, int applies, double *delay)
+{
+  struct emu *e = s->emu;
+  double u;
+
+  if (e->loss.model == LOSS_GILBERT) {
+    u = jimsrand(s, RNG_LOSS + AorB);
+    if (u < (e->bad[AorB] ? e->loss.r : e->loss.p))
+      e->bad[AorB] = !e->bad[AorB];
+    u = jimsrand(s, RNG_LOSS + AorB);
+    return applies && u < (e->bad[AorB] ? e->loss.lossbad : e->loss.lossgood);
+  }
+  if (e->loss.model == LOSS_TRACE)
+    return applies && losstrace_next(&e->trace[AorB], delay);
+  return jimsrand(s, RNG_LOSS + AorB) < e->lossprob && applies;
+}
+
+void tolayer3_send(struct sim *s, int AorB, struct pkt *mypktptr)
+/* A or B is sending to network; the packet is ours from now on */
+{
+  struct emu *e = s->emu;
+  struct event *evptr;
+  double lastime, arrival, delay, x;
+  int applies, lost, corrupt;
+
+  if (mypktptr->length < 0 || mypktptr->length > e->mss) {
+    printf("tolayer3: packet of %d bytes does not fit in a %d byte segment\n",
+           mypktptr->length, e->mss);
+    exit(EXIT_FAILURE);
+  }
+  if (mypktptr->sacklen < 0 || mypktptr->sacklen > s->config.sackroom) {
+    printf("tolayer3: selective ACK of %d bytes does not fit in %d bytes\n",
+           mypktptr->sacklen, s->config.sackroom);
+    exit(EXIT_FAILURE);
+  }
+  e->ntolayer3++;
+  e->bytes_tolayer3 += mypktptr->length;
+  e->bytes_wire += HEADERBYTES + mypktptr->length + mypktptr->sacklen;
+  LOGEVENT(s, TR_TOLAYER3, AorB, mypktptr->seqnum, mypktptr->acknum, mypktptr->checksum, 0.0);
+
+  /* the channel's random numbers for the packet, drawn before the link
+     can drop it so that the packets after it draw the same ones however
+     full the queue is */
+  applies = !(AorB == B && e->corruptdirection == A) && !(AorB == A && e->corruptdirection == B);
+  delay = -1.0;
+  lost = packetlost(s, AorB, applies, &delay);
+  corrupt = 0;
+  x = 0.0;
+  if (!lost && jimsrand(s, RNG_CORRUPT + AorB) < e->corruptprob && applies) {
+    corrupt = 1;
+    x = jimsrand(s, RNG_CORRUPT + AorB);
+  }
+
+  /* wait for the link, unless its queue is full; a packet that is lost
+     below still takes its turn on the link */
+  arrival = 0.0;
+  if (e->link[AorB].rate > 0) {
+    arrival = link_send(&e->link[AorB], HEADERBYTES + mypktptr->length + mypktptr->sacklen, s->time);
+    if (arrival < 0) {
+      LOGEVENT(s, TR_QDROP, AorB, mypktptr->seqnum, mypktptr->acknum, mypktptr->checksum, 0.0);
+      if (TRACE_ABOVE(0))
+        printf("          TOLAYER3: queue full, packet dropped\n");
+      pkt_free(s, mypktptr);
+      return;
+    }
+  }
 
   /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    nlost++;
-    if (TRACE>0)    
+  if (lost && !e->lastlost[AorB])
+    e->lossbursts++;
+  e->lastlost[AorB] = lost;
+  if (lost) {
+    e->nlost++;
+    LOGEVENT(s, TR_LOST, AorB, mypktptr->seqnum, mypktptr->acknum, mypktptr->checksum, 0.0);
+    if (TRACE_ABOVE(0))    
       printf("          TOLAYER3: packet being lost\n");
+    pkt_free(s, mypktptr);
     return;
   }  
 
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
-  if (TRACE>2)  {
+  /* the arrival of the packet at the other side */
+  evptr = allocevent(e);
+  evptr->pkt = mypktptr;
+  if (TRACE_ABOVE(2))  {
     printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
            mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
-      printf("%c",mypktptr->payload[i]);
-    printf("\n");
+    printf("%.*s\n", mypktptr->length, mypktptr->payload);
   }
 
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
   /* finally, compute the arrival time of packet at the other end.
      medium can not reorder, so make sure packet arrives between 1 and 10
      time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
+     currently in the medium on their way to the destination.  The link
+     model has worked it out already. */
+  if (e->link[AorB].rate > 0)
+    evptr->evtime = arrival;
+  else if (delay >= 0) {
+    /* from the loss trace, but never ahead of the packet in front */
+    evptr->evtime = s->time + delay;
+    if (e->chaninflight[evptr->eventity] > 0 && evptr->evtime <= e->chantail[evptr->eventity])
+      evptr->evtime = nextafter(e->chantail[evptr->eventity], HUGE_VAL);
+  }
+  else {
+    if (e->chaninflight[evptr->eventity] > 0)
+      lastime = e->chantail[evptr->eventity];
+    else
+      lastime = s->time;
+    evptr->evtime =  lastime + 1 + 9*jimsrand(s, RNG_DELAY + AorB);
+  }
+  e->chantail[evptr->eventity] = evptr->evtime;
+  e->chaninflight[evptr->eventity]++;
  
 
 
   /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
-    if ( (x = jimsrand()) < .75)
+  if (corrupt) {
+    e->ncorrupt++;
+    LOGEVENT(s, TR_CORRUPT, AorB, mypktptr->seqnum, mypktptr->acknum, mypktptr->checksum, 0.0);
+    if (x < .75 && mypktptr->length + mypktptr->sacklen > 0)
       mypktptr->payload[0]='Z';   /* corrupt payload */
+    else if (x < .75)
+      mypktptr->acknum = 999999;  /* no payload, corrupt the header */
     else if (x < .875)
       mypktptr->seqnum = 999999;
     else
       mypktptr->acknum = 999999;
-    if (TRACE>0)    
+    if (TRACE_ABOVE(0))    
       printf("          TOLAYER3: packet being corrupted\n");
   }  
 
-  if (TRACE>2)  
+  if (TRACE_ABOVE(2))  
     printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
+  insertevent(s, evptr);
 } 
 
-void tolayer5(int AorB, char datasent[20])
+void tolayer5(struct sim *s, int AorB, const char *datasent, int length)
 {
-  int i;  
-  if (TRACE>2) {
+  struct emu *e = s->emu;
+  double latency;
+
+  if (TRACE_ABOVE(2)) {
     printf("          TOLAYER5: data received by application at ");
     if (AorB == A) 
       printf("A: ");
     else
       printf("B: ");
-    for (i=0; i<20; i++)  
-      printf("%c",datasent[i]);
-    printf("\n");
+    printf("%.*s\n", length, datasent);
+  }
+  LOGEVENT(s, TR_TOLAYER5, AorB, e->messages_delivered, -1, 0, 0.0);
+  e->messages_delivered++;
+  e->bytes_delivered += length;
+
+  /* the message came from the other side */
+  if (e->born[1 - AorB].n > 0) {
+    latency = s->time - stamps_pop(&e->born[1 - AorB]);
+    if (e->latn == 0 || latency < e->latmin)
+      e->latmin = latency;
+    if (latency > e->latmax)
+      e->latmax = latency;
+    e->latsum += latency;
+    e->latn++;
+    e->lathist[latbucket(latency)]++;
   }
-  messages_delivered++;
 }
 
-int main(void)
+/* record a change of a sender's congestion window in the event log */
+void logcwnd(struct sim *s, int AorB, double cwnd)
 {
+  LOGEVENT(s, TR_CWND, AorB, -1, -1, 0, cwnd);
+}
+
+/* run one simulation with the given parameters until no events are left.
+   Simulations share no state, so several may run at once in different
+   threads. */
+void runsim(const struct simconfig *cfg, struct simresult *res)
+{
+  struct sim *s;
+  struct emu *e;
   struct event *eventptr;
   struct msg  msg2give;
-  struct pkt  pkt2give;
+  const struct protocol *p = protocols[cfg->protocol];
+  long long full;
    
-  int i,j;
+  int j;
   
-  init();
-  A_init();
-  B_init();
+  s = newsim(cfg);
+  e = s->emu;
+  p->A_init(s);
+  p->B_init(s);
    
   while (1) {
-    eventptr = evlist;            /* get next event to simulate */
+    eventptr = e->fes->popmin(e); /* get next event to simulate */
     if (eventptr==NULL)
       goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
-    if (TRACE>=2) {
+    if (eventptr->evtype == TIMER_CANCELLED) {
+      freeevent(e, eventptr);       /* timer was stopped, nothing to do */
+      continue;
+    }
+    e->nevents++;
+    if (TRACE_ABOVE(1)) {
       printf("\nEVENT time: %f,",eventptr->evtime);
       printf("  type: %d",eventptr->evtype);
       if (eventptr->evtype==0)
@@ -419,60 +1245,121 @@ int main(void)
         printf(", fromlayer3 ");
       printf(" entity: %d\n",eventptr->eventity);
     }
-    time = eventptr->evtime;        /* update time to next event time */
+    s->time = eventptr->evtime;     /* update time to next event time */
     if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
+      if (e->nsim < e->nsimmax) {
+        generate_next_arrival(s);  /* set up future arrival */
         /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
+        msg2give.length = e->msgmin;
+        if (e->msgmax > e->msgmin)
+          msg2give.length += (int)((e->msgmax - e->msgmin + 1) * jimsrand(s, RNG_MSGSIZE));
+        msg2give.data = e->msgbuf;
+        j = e->nsim % 26; 
+        memset(msg2give.data, 97 + j, msg2give.length);
+        e->bytes_fromlayer5 += msg2give.length;
+        if (TRACE_ABOVE(2)) {
           printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
+          printf("%.*s\n", msg2give.length, msg2give.data);
         }
-        nsim++;
+        LOGEVENT(s, TR_FROMLAYER5, eventptr->eventity, e->nsim, -1, 0, 0.0);
+        e->nsim++;
+        full = s->stats.window_full;
         if (eventptr->eventity == A) 
-          A_output(msg2give);  
+          p->A_output(s, msg2give);  
         else
-          B_output(msg2give);  
+          p->B_output(s, msg2give);  
+        /* a message turned away will never be delivered */
+        if (s->stats.window_full == full)
+          stamps_push(&e->born[eventptr->eventity], s->time);
       }
-      else if (TRACE > 2)
+      else if (TRACE_ABOVE(2))
           printf("          FROM_LAYER5: no more messages to send: \n");
     }
     else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
+      e->chaninflight[eventptr->eventity]--;
+      LOGEVENT(s, TR_FROMLAYER3, eventptr->eventity, eventptr->pkt->seqnum,
+               eventptr->pkt->acknum, eventptr->pkt->checksum, 0.0);
+      /* the receiver borrows the packet until it returns */
 	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
+        p->A_input(s, eventptr->pkt);   /* appropriate entity */
       else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
+        p->B_input(s, eventptr->pkt);
+      pkt_free(s, eventptr->pkt);
     }
     else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+      e->timers[eventptr->eventity] = NULL;
+      LOGEVENT(s, TR_TIMEOUT, eventptr->eventity, -1, -1, 0, 0.0);
       if (eventptr->eventity == A) 
-        A_timerinterrupt();
+        p->A_timerinterrupt(s);
       else
-        B_timerinterrupt();
+        p->B_timerinterrupt(s);
     }
     else  {
       printf("INTERNAL PANIC: unknown event type \n");
     }
-    free(eventptr);
+    freeevent(e, eventptr);
   }
 
  terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
-  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+  res->time = s->time;
+  res->nsim = e->nsim;
+  res->window_full = s->stats.window_full;
+  res->total_ACKs_received = s->stats.total_ACKs_received;
+  res->new_ACKs = s->stats.new_ACKs;
+  res->packets_resent = s->stats.packets_resent;
+  res->packets_received = s->stats.packets_received;
+  res->messages_delivered = e->messages_delivered;
+  res->ntolayer3 = e->ntolayer3;
+  res->nlost = e->nlost;
+  res->ncorrupt = e->ncorrupt;
+  res->lossbursts = e->lossbursts;
+  res->fast_retransmits = s->stats.fast_retransmits;
+  res->acks_sent = s->stats.acks_sent;
+  res->acks_piggybacked = s->stats.acks_piggybacked;
+  res->srtt = s->stats.srtt;
+  res->rttvar = s->stats.rttvar;
+  res->rto = s->stats.rto;
+  res->rtt_samples = s->stats.rtt_samples;
+  res->cwnd_peak = s->stats.cwnd_peak;
+  res->cwnd_mean = s->stats.cwnd;
+  if (s->time > 0.0)
+    res->cwnd_mean = (s->stats.cwnd_area +
+                      s->stats.cwnd * (s->time - s->stats.cwnd_since)) / s->time;
+  res->events = e->nevents;
+  res->evpeak = e->evpeak;
+  res->nevslabs = e->nevslabs;
+  res->evslabsize = EVSLAB;
+  res->evpoolbytes = (unsigned long)e->nevslabs * sizeof(struct evslab);
+  res->pktpeak = e->pktpeak;
+  res->npktslabs = e->npktslabs;
+  res->pktslabsize = PKTSLAB;
+  res->pktpoolbytes = (unsigned long)e->npktslabs * (sizeof(struct pktslab) + (size_t)PKTSLAB * e->pktroom);
+  res->bytes_fromlayer5 = e->bytes_fromlayer5;
+  res->bytes_tolayer3 = e->bytes_tolayer3;
+  res->bytes_delivered = e->bytes_delivered;
+  res->bytes_wire = e->bytes_wire;
+  res->latency.n = e->latn;
+  res->latency.min = e->latmin;
+  res->latency.max = e->latmax;
+  res->latency.mean = e->latn > 0 ? e->latsum / e->latn : 0.0;
+  res->latency.p50 = res->latency.p90 = res->latency.p99 = res->latency.p999 = 0.0;
+  if (e->latn > 0) {
+    res->latency.p50 = latpercentile(e, 0.50);
+    res->latency.p90 = latpercentile(e, 0.90);
+    res->latency.p99 = latpercentile(e, 0.99);
+    res->latency.p999 = latpercentile(e, 0.999);
+  }
+  memcpy(res->latency.hist, e->lathist, sizeof(e->lathist));
+  memset(res->link, 0, sizeof(res->link));
+  for (j = A; j <= B; j++)
+    if (e->link[j].rate > 0) {
+      link_advance(&e->link[j], s->time);
+      res->link[j].drops = e->link[j].drops;
+      res->link[j].peak = e->link[j].peak;
+      if (s->time > 0.0) {
+        res->link[j].mean = e->link[j].area / s->time;
+        res->link[j].utilization = e->link[j].busy / s->time;
+      }
+    }
+  freesim(s);
+}
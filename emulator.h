@@ -1,11 +1,72 @@
+/* TRACE selects how much the emulator and protocols print at run time.
+   Tracing above TRACE_MAX is compiled out altogether: build with
+   -DTRACE_MAX=0 and every TRACE_ABOVE() test folds to false. */
+#ifndef TRACE_MAX
+#define TRACE_MAX 4
+#endif
+#define TRACE_ABOVE(n) (TRACE_MAX > (n) && TRACE > (n))
+
 extern int TRACE;
 
 /* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
+struct simstats {
+  long long total_ACKs_received;
+  long long packets_resent;       /* count of the number of packets resent  */
+  long long new_ACKs;      /* count of the number of acks correctly received */
+  long long packets_received;  /* count of the packets received by receiver */
+  long long window_full; /* count of the number of messages dropped due to full window;
+                            the emulator takes a message that leaves it
+                            unchanged to be on its way to the other side */
+  double srtt;           /* round trip time estimate at A ... */
+  double rttvar;         /* ... its variation ... */
+  double rto;            /* ... and A's retransmission timeout */
+  long long rtt_samples; /* round trip times A has measured */
+  double cwnd;           /* A's congestion window, if it has one ... */
+  double cwnd_peak;      /* ... its largest value ... */
+  double cwnd_area;      /* ... and its integral over time up to ... */
+  double cwnd_since;     /* ... this time, when it last changed */
+  long long acks_sent;   /* packets sent only to acknowledge */
+  long long acks_piggybacked; /* ACKs that went out on data packets */
+  long long fast_retransmits; /* resends set off by duplicate ACKs */
+};
+
+/* protocol parameters chosen at startup; 0 selects the protocol's default */
+struct protoconfig {
+  int windowsize;         /* maximum number of unacked packets */
+  int seqspace;           /* number of sequence numbers, 0 = the fewest the
+                             protocol can work with for this window */
+  int adaptive_rto;       /* 1 = estimate the retransmission timeout from
+                             measured round trip times, 0 = fixed */
+  int congestion;         /* 1 = AIMD congestion window, 0 = none */
+  int dupthresh;          /* GBN: duplicate ACKs that set off a fast
+                             retransmit, 0 = none */
+  int checksum;           /* packet checksum, CK_* from checksum.h */
+  int mss;                /* maximum segment size: payload bytes a packet
+                             can carry, and the largest message */
+  int bidirectional;      /* 1 = messages arrive from layer 5 at both A
+                             and B, 0 = at A only */
+  int sack;               /* 1 = SR ACKs are cumulative with a selective
+                             ACK bitmap, 0 = one ACK per packet */
+  int ackevery;           /* ACK at most every ackevery packets in order
+                             (delayed ACKs); 0 or 1 = every packet */
+  double ackdelay;        /* longest an ACK is held back, 0 = the
+                             protocol's default */
+  int sackroom;           /* bytes every packet buffer has after its mss
+                             for a selective ACK bitmap (set by the
+                             emulator: one bit per packet of the window) */
+};
+
+/* A simulation.  Every emulator routine and every protocol routine is
+   handed the simulation it belongs to, and protocols keep their state in
+   state[A] and state[B] rather than in global variables, so that any
+   number of simulations can run in one process. */
+struct sim {
+  struct simstats stats;  /* statistics updated by the protocol */
+  double time;            /* current simulated time (read only) */
+  struct protoconfig config; /* protocol parameters (read only) */
+  void *state[2];         /* protocol state of entity A and B */
+  struct emu *emu;        /* emulator internals, do not touch */
+};
 
 #define   A    0
 #define   B    1
@@ -13,28 +74,73 @@ extern int window_full; /* count of the number of messages dropped due to full w
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
 /* to layer 5 via the students transport level protocol entities.         */
+/* The data belongs to the emulator and is only valid during the call.    */
 struct msg {
-  char data[20];
+  int length;             /* bytes of data, at most config.mss */
+  char *data;
 };
 
 /* a packet is the data unit passed from layer 4 (students code) to layer */
 /* 3 (teachers code).  Note the pre-defined packet structure, which all   */
 /* students must follow. */
+/* payload points at a buffer of config.mss + config.sackroom bytes that */
+/* belongs with the packet: copy packets with pkt_copy(), never by        */
+/* assignment, which would make two packets share one buffer.  A          */
+/* selective ACK bitmap, if any, follows the length bytes of data.        */
 struct pkt {
   int seqnum;
   int acknum;
   int checksum;
-  char payload[20];
+  int length;             /* bytes of payload in use */
+  int sacklen;            /* bytes of selective ACK after them */
+  char *payload;
 };
 
 /* send to A or B (int), packet to send */
-extern void tolayer3(int, struct pkt);  
+extern void tolayer3(struct sim *, int, struct pkt);  
+
+/* Sending without copies: get a packet buffer from the emulator, fill it
+   in and hand it to tolayer3_send(), which takes it over.  It comes with
+   length and sacklen 0.  A buffer that
+   is not sent goes back with pkt_free(). */
+extern struct pkt *pkt_alloc(struct sim *);
+extern void tolayer3_send(struct sim *, int, struct pkt *);
+extern void pkt_free(struct sim *, struct pkt *);
 
-/* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
+/* copy a packet, header and payload, into another packet's buffer */
+extern void pkt_copy(struct pkt *, const struct pkt *);
+
+/* deliver to A or B (int), data to deliver, its length */
+extern void tolayer5(struct sim *, int, const char *, int); 
 
 /* start timer at A or B (int), increment */
-extern void starttimer(int, double);       
+extern void starttimer(struct sim *, int, double);       
 
 /* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern void stoptimer(struct sim *, int);               
+
+/* record the congestion window of A or B (int) in the event log */
+extern void logcwnd(struct sim *, int, double);
+
+/* zeroed memory for protocol state, freed when the simulation ends */
+extern void *sim_alloc(struct sim *, size_t);
+
+/* A protocol's entry points, called by the emulator.  Each protocol
+   defines one of these (gbn_protocol in gbn.h, sr_protocol in sr.h) and
+   keeps the routines themselves static, so any number of protocols can be
+   linked into one program; the emulator picks one by name at run time. */
+struct protocol {
+  const char *name;
+  void (*A_init)(struct sim *);
+  void (*B_init)(struct sim *);
+  void (*A_output)(struct sim *, struct msg);
+  void (*B_output)(struct sim *, struct msg); /* only with config.bidirectional */
+  void (*A_input)(struct sim *, const struct pkt *);
+  void (*B_input)(struct sim *, const struct pkt *);
+  void (*A_timerinterrupt)(struct sim *);
+  void (*B_timerinterrupt)(struct sim *);
+};
+
+/* an array of (int) packets, each with its own payload buffer of
+   config.mss + config.sackroom bytes, freed when the simulation ends */
+extern struct pkt *sim_allocpkts(struct sim *, int);
@@ -1,8 +1,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "emulator.h"
 #include "gbn.h"
+#include "rto.h"
+#include "checksum.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -22,242 +25,450 @@
    - added GBN implementation
 **********************************************************************/
 
-#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet
-                          MUST BE SET TO 6 when submitting assignment */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
+#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment
+                           (the timeout, or the first timeout if it is adaptive) */
+#define WINDOWSIZE 6    /* default maximum number of buffered unacked packet
+                          MUST BE SET TO 6 when submitting assignment.
+                          The sequence space defaults to windowsize + 1 */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define ACKDELAY (RTT / 2) /* longest a delayed ACK waits, unless config.ackdelay says */
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
-   the packet is corrupted.
+   the packet is corrupted.  Which checksum is used is chosen at startup, see checksum.h.
 */
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(struct sim *s, const struct pkt *packet)
 {
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ )
-    checksum += (int)(packet.payload[i]);
-
-  return checksum;
+  return pkt_checksum(s->config.checksum, packet);
 }
 
-bool IsCorrupted(struct pkt packet)
+static bool IsCorrupted(struct sim *s, const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == ComputeChecksum(s, packet))
     return (false);
   else
     return (true);
 }
 
 
+/* the window size and sequence space for this run, checked against each other */
+static void getwindow(struct sim *s, int *windowsize, int *seqspace)
+{
+  *windowsize = s->config.windowsize > 0 ? s->config.windowsize : WINDOWSIZE;
+  *seqspace = s->config.seqspace > 0 ? s->config.seqspace : *windowsize + 1;
+  if (*seqspace < *windowsize + 1) {
+    printf("GBN needs a sequence space of at least window size + 1 (window %d, seqspace %d)\n",
+           *windowsize, *seqspace);
+    exit(EXIT_FAILURE);
+  }
+  if (s->config.bidirectional) {
+    printf("GBN only carries data from A to B\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* how long B may hold an ACK back */
+static double ackdelay(struct sim *s)
+{
+  return s->config.ackdelay > 0 ? s->config.ackdelay : ACKDELAY;
+}
+
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+/* With congestion control on, the window buffer may hold packets that
+   have not been sent yet: only the first cwnd packets of the window are
+   allowed in flight.  cwnd starts at one packet, grows by one for every
+   packet ACKed below ssthresh (slow start) and by 1/cwnd above it
+   (additive increase), and drops back to one on a timeout, with ssthresh
+   set to half the packets then in flight (multiplicative decrease).
+   Without it cwnd is the window size and every buffered packet is sent
+   at once.
+
+   With config.dupthresh set, that many duplicate ACKs in a row (B
+   re-ACKs its last in-order packet for every packet out of order) are
+   taken as a loss and the window is resent at once, without waiting for
+   the timer: a fast retransmit.  The congestion window is halved rather
+   than dropped to one, as the ACKs show packets are still getting
+   through. */
+struct sender {
+  struct pkt *buffer;             /* array for storing packets waiting for ACK */
+  bool *sent;                     /* whether each packet in buffer has been sent */
+  double *sendtime;               /* when each packet in buffer was first sent */
+  bool *resent;                   /* whether it has been sent again since */
+  int windowsize;                 /* number of slots in buffer */
+  int seqspace;                   /* sequence numbers run from 0 to seqspace - 1 */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int windowsent;                 /* how many of them are in flight */
+  int A_nextseqnum;               /* the next sequence number to be used by the sender */
+  struct rto rto;                 /* retransmission timeout */
+  int dupacks;                    /* duplicate ACKs since the last new one */
+  bool congestion;                /* congestion control on */
+  double cwnd;                    /* congestion window, in packets */
+  double ssthresh;                /* slow start threshold */
+};
+
+static void setcwnd(struct sim *s, double cwnd)
+{
+  struct sender *a = s->state[A];
+
+  if (cwnd > a->windowsize)
+    cwnd = a->windowsize;
+  if (cwnd == a->cwnd)
+    return;
+  s->stats.cwnd_area += a->cwnd * (s->time - s->stats.cwnd_since);
+  s->stats.cwnd_since = s->time;
+  a->cwnd = cwnd;
+  s->stats.cwnd = cwnd;
+  if (cwnd > s->stats.cwnd_peak)
+    s->stats.cwnd_peak = cwnd;
+  if (TRACE_ABOVE(0))
+    printf("----A: congestion window %f, ssthresh %f\n", a->cwnd, a->ssthresh);
+  logcwnd(s, A, cwnd);
+}
+
+/* after a go back N no packet sent so far can be timed: an ACK for one
+   of them may belong to either copy, or have waited on a resend (Karn) */
+static void untimeable(struct sender *a)
+{
+  int k;
 
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+  for (k = 0; k < a->windowsent; k++)
+    a->resent[(a->windowfirst + k) % a->windowsize] = true;
+}
+
+/* send the packets of the window that the congestion window allows and
+   that are not in flight yet, starting the timer with the first */
+static void sendwindow(struct sim *s)
 {
-  struct pkt sendpkt;
+  struct sender *a = s->state[A];
+  int limit = a->windowcount;
+  struct pkt *p;
   int i;
 
+  if (a->congestion && a->cwnd < limit)
+    limit = (int)a->cwnd;
+  while (a->windowsent < limit) {
+    i = (a->windowfirst + a->windowsent) % a->windowsize;
+    if (a->sent[i]) {
+      if (TRACE_ABOVE(0))
+        printf ("---A: resending packet %d\n", a->buffer[i].seqnum);
+      a->resent[i] = true;
+      s->stats.packets_resent++;
+    }
+    else {
+      if (TRACE_ABOVE(0))
+        printf("Sending packet %d to layer 3\n", a->buffer[i].seqnum);
+      a->sent[i] = true;
+      a->sendtime[i] = s->time;
+    }
+    /* the window keeps its copy for resending, the emulator gets its own */
+    p = pkt_alloc(s);
+    pkt_copy(p, &a->buffer[i]);
+    tolayer3_send(s, A, p);
+    if (a->windowsent == 0)
+      starttimer(s, A, rto_timeout(&a->rto));
+    a->windowsent++;
+  }
+}
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+static void A_output(struct sim *s, struct msg message)
+{
+  struct sender *a = s->state[A];
+  struct pkt *sendpkt;
+
   /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
-    if (TRACE > 1)
+  if ( a->windowcount < a->windowsize) {
+    if (TRACE_ABOVE(1))
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
-    /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for ( i=0; i<20 ; i++ )
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-
-    /* put packet in window buffer */
+    /* create packet, in place in the window buffer */
     /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    windowcount++;
-
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
-
-    /* start timer if first packet in window */
-    if (windowcount == 1)
-      starttimer(A,RTT);
+    a->windowlast = (a->windowlast + 1) % a->windowsize;
+    sendpkt = &a->buffer[a->windowlast];
+    sendpkt->seqnum = a->A_nextseqnum;
+    sendpkt->acknum = NOTINUSE;
+    sendpkt->length = message.length;
+    memcpy(sendpkt->payload, message.data, message.length);
+    sendpkt->checksum = ComputeChecksum(s, sendpkt);
+
+    a->sent[a->windowlast] = false;
+    a->resent[a->windowlast] = false;
+    a->windowcount++;
+
+    /* send out packet if the congestion window allows, starting the
+       timer if it is the first packet in flight */
+    sendwindow(s);
 
     /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+    a->A_nextseqnum = (a->A_nextseqnum + 1) % a->seqspace;
   }
   /* if blocked,  window is full */
   else {
-    if (TRACE > 0)
+    if (TRACE_ABOVE(0))
       printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    s->stats.window_full++;
   }
 }
 
 
+/* resend the window after config.dupthresh duplicate ACKs */
+static void fastretransmit(struct sim *s)
+{
+  struct sender *a = s->state[A];
+
+  if (TRACE_ABOVE(0))
+    printf("----A: %d duplicate ACKs, fast retransmit!\n", a->dupacks);
+  s->stats.fast_retransmits++;
+
+  /* multiplicative decrease, but no slow start */
+  if (a->congestion) {
+    a->ssthresh = a->windowsent / 2 > 2 ? a->windowsent / 2 : 2;
+    setcwnd(s, a->ssthresh);
+  }
+
+  /* go back N now; sendwindow() restarts the timer */
+  stoptimer(s, A);
+  untimeable(a);
+  a->windowsent = 0;
+  sendwindow(s);
+}
+
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
+static void A_input(struct sim *s, const struct pkt *packet)
 {
+  struct sender *a = s->state[A];
   int ackcount = 0;
   int i;
 
   /* if received ACK is not corrupted */
-  if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
-    total_ACKs_received++;
+  if (!IsCorrupted(s, packet)) {
+    if (TRACE_ABOVE(0))
+      printf("----A: uncorrupted ACK %d is received\n",packet->acknum);
+    s->stats.total_ACKs_received++;
 
     /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
+    if (a->windowcount != 0) {
+          int seqfirst = a->buffer[a->windowfirst].seqnum;
+          int seqlast = a->buffer[a->windowlast].seqnum;
           /* check case when seqnum has and hasn't wrapped */
-          if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-              ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
+          if (((seqfirst <= seqlast) && (packet->acknum >= seqfirst && packet->acknum <= seqlast)) ||
+              ((seqfirst > seqlast) && (packet->acknum >= seqfirst || packet->acknum <= seqlast))) {
 
             /* packet is a new ACK */
-            if (TRACE > 0)
-              printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-            new_ACKs++;
+            if (TRACE_ABOVE(0))
+              printf("----A: ACK %d is not a duplicate\n",packet->acknum);
+            s->stats.new_ACKs++;
 
             /* cumulative acknowledgement - determine how many packets are ACKed */
-            if (packet.acknum >= seqfirst)
-              ackcount = packet.acknum + 1 - seqfirst;
+            if (packet->acknum >= seqfirst)
+              ackcount = packet->acknum + 1 - seqfirst;
             else
-              ackcount = SEQSPACE - seqfirst + packet.acknum;
+              ackcount = a->seqspace - seqfirst + packet->acknum;
+
+            /* time the round trip of the packet being ACKed, unless it was
+               resent and the ACK could belong to either copy (Karn) */
+            i = (a->windowfirst + ackcount - 1) % a->windowsize;
+            if (!a->resent[i]) {
+              rto_sample(&a->rto, s->time - a->sendtime[i]);
+              rto_report(&a->rto, &s->stats);
+            }
 
 	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
+            a->windowfirst = (a->windowfirst + ackcount) % a->windowsize;
 
             /* delete the acked packets from window buffer */
             for (i=0; i<ackcount; i++)
-              windowcount--;
-
-	    /* start timer again if there are still more unacked packets in window */
-            stoptimer(A);
-            if (windowcount > 0)
-              starttimer(A, RTT);
-
+              a->windowcount--;
+            a->windowsent = ackcount < a->windowsent ? a->windowsent - ackcount : 0;
+
+            /* open the congestion window: slow start, then additive increase */
+            if (a->congestion)
+              for (i=0; i<ackcount; i++)
+                setcwnd(s, a->cwnd < a->ssthresh ? a->cwnd + 1 : a->cwnd + 1 / a->cwnd);
+
+	    /* start timer again if there are still more unacked packets in flight */
+            stoptimer(s, A);
+            if (a->windowsent > 0)
+              starttimer(s, A, rto_timeout(&a->rto));
+
+            /* and send whatever the window now allows */
+            a->dupacks = 0;
+            sendwindow(s);
+            return;
           }
-        }
-        else
-          if (TRACE > 0)
-        printf ("----A: duplicate ACK received, do nothing!\n");
+    }
+    if (TRACE_ABOVE(0))
+      printf ("----A: duplicate ACK received, do nothing!\n");
+    if (a->windowsent > 0 && ++a->dupacks == s->config.dupthresh)
+      fastretransmit(s);
   }
   else
-    if (TRACE > 0)
+    if (TRACE_ABOVE(0))
       printf ("----A: corrupted ACK is received, do nothing!\n");
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+static void A_timerinterrupt(struct sim *s)
 {
-  int i;
+  struct sender *a = s->state[A];
 
-  if (TRACE > 0)
+  if (TRACE_ABOVE(0))
     printf("----A: time out,resend packets!\n");
 
-  for(i=0; i<windowcount; i++) {
+  rto_backoff(&a->rto);
+  rto_report(&a->rto, &s->stats);
+  a->dupacks = 0;
 
-    if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
-
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
-    packets_resent++;
-    if (i==0) starttimer(A,RTT);
+  /* multiplicative decrease: half the flight becomes the threshold and
+     the window starts again from one packet */
+  if (a->congestion) {
+    a->ssthresh = a->windowsent / 2 > 2 ? a->windowsent / 2 : 2;
+    setcwnd(s, 1);
   }
+
+  /* go back N: everything in the window is resent, as far as the
+     congestion window allows */
+  untimeable(a);
+  a->windowsent = 0;
+  sendwindow(s);
 }
 
 
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+static void A_init(struct sim *s)
 {
+  struct sender *a = sim_alloc(s, sizeof(struct sender));
+
+  s->state[A] = a;
+  getwindow(s, &a->windowsize, &a->seqspace);
+  a->buffer = sim_allocpkts(s, a->windowsize);
+  a->sent = sim_alloc(s, a->windowsize * sizeof(bool));
+  a->sendtime = sim_alloc(s, a->windowsize * sizeof(double));
+  a->resent = sim_alloc(s, a->windowsize * sizeof(bool));
+  /* B may hold its ACK back, so wait that much longer */
+  rto_init(&a->rto, s->config.adaptive_rto,
+           s->config.ackevery > 1 ? RTT + ackdelay(s) : RTT);
+  rto_report(&a->rto, &s->stats);
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.
+  a->dupacks = 0;
+  a->A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  a->windowfirst = 0;
+  a->windowlast = -1;   /* windowlast is where the last packet sent is stored.
 		     new packets are placed in winlast + 1
 		     so initially this is set to -1
 		   */
-  windowcount = 0;
+  a->windowcount = 0;
+  a->windowsent = 0;
+  a->congestion = s->config.congestion;
+  a->cwnd = a->windowsize;
+  a->ssthresh = a->windowsize;
+  if (a->congestion) {
+    a->cwnd = 0;                /* so that setcwnd records the first window */
+    setcwnd(s, 1);
+  }
 }
 
 
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+/* With config.ackevery > 1, B delays its ACKs: packets that arrive in
+   order are acknowledged together, every ackevery of them or when B's
+   timer goes off ackdelay after the first.  Anything else, a corrupted
+   or out of order packet, may mean one was lost and is answered at once
+   so that the sender hears of it soon. */
+struct receiver {
+  int seqspace;       /* sequence numbers run from 0 to seqspace - 1 */
+  int expectedseqnum; /* the sequence number expected next by the receiver */
+  int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+  int unacked;        /* packets received in order and not yet ACKed */
+  bool timer_running; /* B's timer is waiting to send them */
+};
+
+/* send an ACK for everything up to expectedseqnum */
+static void sendack(struct sim *s)
+{
+  struct receiver *b = s->state[B];
+  struct pkt *sendpkt = pkt_alloc(s);
+
+  if (b->timer_running) {
+    stoptimer(s, B);
+    b->timer_running = false;
+  }
+  b->unacked = 0;
+
+  /* create packet */
+  if (b->expectedseqnum == 0)
+    sendpkt->acknum = b->seqspace - 1;
+  else
+    sendpkt->acknum = b->expectedseqnum - 1;
+  sendpkt->seqnum = b->B_nextseqnum;
+  b->B_nextseqnum = (b->B_nextseqnum + 1) % 2;
 
+  /* we don't have any data to send */
+  sendpkt->length = 0;
+
+  /* computer checksum */
+  sendpkt->checksum = ComputeChecksum(s, sendpkt);
+
+  /* send out packet */
+  s->stats.acks_sent++;
+  tolayer3_send(s, B, sendpkt);
+}
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+static void B_input(struct sim *s, const struct pkt *packet)
 {
-  struct pkt sendpkt;
-  int i;
+  struct receiver *b = s->state[B];
 
   /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
-    if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-    packets_received++;
+  if  ( (!IsCorrupted(s, packet))  && (packet->seqnum == b->expectedseqnum) ) {
+    if (TRACE_ABOVE(0))
+      printf("----B: packet %d is correctly received, send ACK!\n",packet->seqnum);
+    s->stats.packets_received++;
 
     /* deliver to receiving application */
-    tolayer5(B, packet.payload);
-
-    /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
+    tolayer5(s, B, packet->payload, packet->length);
 
     /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
+    b->expectedseqnum = (b->expectedseqnum + 1) % b->seqspace;
+
+    /* send an ACK for the received packet, now or with the next ones */
+    if (++b->unacked >= s->config.ackevery)
+      sendack(s);
+    else if (!b->timer_running) {
+      starttimer(s, B, ackdelay(s));
+      b->timer_running = true;
+    }
   }
   else {
     /* packet is corrupted or out of order resend last ACK */
-    if (TRACE > 0)
+    if (TRACE_ABOVE(0))
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
-    else
-      sendpkt.acknum = expectedseqnum - 1;
+    sendack(s);
   }
-
-  /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
-
-  /* we don't have any data to send.  fill payload with 0's */
-  for ( i=0; i<20 ; i++ )
-    sendpkt.payload[i] = '0';
-
-  /* computer checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt);
-
-  /* send out packet */
-  tolayer3 (B, sendpkt);
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+static void B_init(struct sim *s)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
+  struct receiver *b = sim_alloc(s, sizeof(struct receiver));
+  int windowsize;
+
+  s->state[B] = b;
+  getwindow(s, &windowsize, &b->seqspace);
+  b->expectedseqnum = 0;
+  b->B_nextseqnum = 1;
+  b->unacked = 0;
+  b->timer_running = false;
 }
 
 /******************************************************************************
@@ -265,11 +476,23 @@ void B_init(void)
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+static void B_output(struct sim *s, struct msg message)
 {
 }
 
-/* called when B's timer goes off */
-void B_timerinterrupt(void)
+/* called when B's timer goes off: the delayed ACK is due */
+static void B_timerinterrupt(struct sim *s)
 {
+  struct receiver *b = s->state[B];
+
+  b->timer_running = false;
+  if (TRACE_ABOVE(0))
+    printf("----B: delayed ACK for %d packet(s) is due\n", b->unacked);
+  sendack(s);
 }
+
+const struct protocol gbn_protocol = {
+  "gbn",
+  A_init, B_init, A_output, B_output, A_input, B_input,
+  A_timerinterrupt, B_timerinterrupt
+};
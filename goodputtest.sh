@@ -0,0 +1,44 @@
+#!/bin/sh
+# Checks that Selective Repeat delivers what it accepts when packets are
+# lost and corrupted.  Each packet has its own timer; with a fixed
+# timeout an expired packet must be resent one timeout later, not backed
+# off, and with an adaptive one the backoff must end at the next new ACK,
+# or the window stalls and goodput falls to a fraction of what SR gets.
+#
+# A message every 30 time units keeps the round trip time under the
+# fixed timeout of 16, so the timer only goes off for lost packets.
+#
+# usage: goodputtest.sh [sim]
+
+sim=${1:-./sim}
+
+{
+  $sim -p sr -n 2000 -m 30 -T fixed -l 0.1,0.2,0.3 -c 0,0.2 -s 1:3:1 -o csv |
+    sed 's/^/0.9,/'
+  $sim -p sr -n 2000 -m 30 -T adaptive -l 0.1,0.2 -s 1:3:1 -o csv |
+    sed 's/^/0.75,/'
+} |
+awk -F, '
+$2 == "protocol" {
+  for (i = 2; i <= NF; i++)
+    col[$i] = i
+  next
+}
+{
+  runs++
+  share = $col["messages_delivered"] / $col["msgs_sent"]
+  if (share < $1) {
+    printf "FAIL: timeout %s loss %s corrupt %s seed %s: %d of %d messages delivered\n",
+           $col["timeout"], $col["loss"], $col["corrupt"], $col["seed"],
+           $col["messages_delivered"], $col["msgs_sent"]
+    failed++
+  }
+}
+END {
+  if (runs == 0) {
+    print "FAIL: no runs"
+    exit 1
+  }
+  printf "%d of %d runs delivered their share of messages\n", runs - failed, runs
+  exit failed > 0
+}'
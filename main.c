@@ -0,0 +1,1181 @@
+/* ******************************************************************
+   Front end for the network emulator.
+
+   Run with no arguments, the simulator asks for its parameters on
+   standard input exactly as it always has.  Otherwise the parameters come
+   from command line flags and/or a configuration file.  The loss,
+   corruption, lambda, window and seed parameters may each be a single value, a
+   comma separated list ("0,0.1,0.2") or an inclusive range written
+   start:stop:step ("0:0.3:0.05").  Every combination of the given values
+   is simulated inside this one process, spread over a pool of worker
+   threads, and when there is more than one run (or csv/json output is
+   asked for) one row is printed per run instead of the usual summary.
+   Rows always come out in the same order whatever the number of threads.
+   Each combination can be replicated: replication r of a seed uses
+   random number streams 2^192 draws beyond replication r-1, so the
+   replications are statistically independent.
+
+   Every protocol is linked in and -p picks one; by default the program
+   name does ("gbn" and "sr" are links to this program).  Given a list
+   of protocols, each run is repeated with each of them on the same
+   random numbers (see emulator.c), and the text output compares them:
+   for each combination, the mean of some results for every protocol and
+   the mean difference from the first protocol, with 95% confidence
+   intervals computed from the paired runs and, for comparison, as if
+   the runs were independent.
+
+   -b writes a binary event log (see trace.h) that tracedump turns back
+   into text.  With more than one run, run i logs to "file.i".
+
+   A configuration file holds one "key = value" pair per line; '#' starts
+   a comment.  The keys are the long names listed by -h.  Flags and files
+   are applied in the order given, so later settings win.
+**********************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "sim.h"
+#include "checksum.h"
+
+#define MAXLINE 1024
+#define MAXVALUES 1000000       /* values a range may give */
+#define MAXRUNS 1000000         /* runs of one sweep */
+
+enum { OUT_DEFAULT, OUT_TEXT, OUT_CSV, OUT_JSON };
+
+/* the values a sweepable parameter takes */
+struct valuelist {
+  int n, size;
+  double *v;
+};
+
+/* seeds are 64 bits, more than a double holds exactly */
+struct seedlist {
+  int n, size;
+  unsigned long long *v;
+};
+
+static struct valuelist lossvals, corruptvals, lambdavals, windowvals;
+static struct seedlist seedvals;
+static struct valuelist protovals;    /* protocol numbers */
+static struct simconfig base;         /* the parameters that are not swept */
+static const struct simresult noresult;
+static int outformat = OUT_DEFAULT;
+static int nthreads = 0;              /* worker threads, 0 = one per core */
+static int replications = 1;          /* runs of each combination */
+static char *logfile = NULL;          /* binary event log, or NULL */
+
+/* one simulation of a sweep */
+struct job {
+  struct simconfig cfg;
+  struct simresult res;
+};
+
+static struct job *jobs;
+static int njobs;
+static int nextjob;                   /* next job to hand to a worker */
+static pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [options]\n", prog);
+  fprintf(stderr, "  -p names    protocol: gbn or sr, or a comma separated list to compare on common\n");
+  fprintf(stderr, "              random numbers (default the program name, or gbn)\n");
+  fprintf(stderr, "  -n count    messages: number of messages to simulate (default 1000)\n");
+  fprintf(stderr, "  -l values   loss: packet loss probability (default 0.0)\n");
+  fprintf(stderr, "  -c values   corrupt: packet corruption probability (default 0.0)\n");
+  fprintf(stderr, "  -g model    lossmodel: bernoulli (loss with probability -l), gilbert:p:r[:good:bad]\n");
+  fprintf(stderr, "              (Gilbert-Elliott, moving good->bad with probability p and back with r,\n");
+  fprintf(stderr, "              losing good and bad of the packets in each state, default 0:1) or\n");
+  fprintf(stderr, "              trace:file[,file] (replay a loss/delay trace, one file or A->B,B->A)\n");
+  fprintf(stderr, "              (default bernoulli)\n");
+  fprintf(stderr, "  -d dir      direction: where loss/corruption occurs, 0 A->B, 1 A<-B, 2 both (default 2)\n");
+  fprintf(stderr, "  -m values   lambda: average time between messages from layer 5 (default 10.0)\n");
+  fprintf(stderr, "  -L spec     link: rate:delay:queue, a link of rate bits per time unit, propagation\n");
+  fprintf(stderr, "              delay and a queue of that many packets (0 = no limit), or two specs\n");
+  fprintf(stderr, "              A->B/B->A (default the original random delay)\n");
+  fprintf(stderr, "  -w values   window: protocol window size (default 6)\n");
+  fprintf(stderr, "  -q count    seqspace: sequence numbers, 0 = the fewest the protocol allows (default 0)\n");
+  fprintf(stderr, "  -T mode     timeout: retransmission timeout, fixed or adaptive (default fixed)\n");
+  fprintf(stderr, "  -C mode     congestion: GBN congestion control, off or aimd (default off)\n");
+  fprintf(stderr, "  -F count    dupacks: GBN fast retransmit after count duplicate ACKs, 0 = never (default 0)\n");
+  fprintf(stderr, "  -k kind     checksum: packet checksum, sum, inet or crc32c (default sum)\n");
+  fprintf(stderr, "  -x mode     traffic: messages arrive at A only (simplex) or at A and B (duplex, SR only) (default simplex)\n");
+  fprintf(stderr, "  -a mode     acks: SR acknowledgements, single (one per packet) or sack (cumulative + bitmap) (default single)\n");
+  fprintf(stderr, "  -E count    ackevery: delay ACKs, acknowledging every count packets in order (default 1)\n");
+  fprintf(stderr, "  -D time     ackdelay: longest an ACK is held back, 0 = the protocol's default (default 0)\n");
+  fprintf(stderr, "  -M bytes    mss: largest payload a packet carries (default 20)\n");
+  fprintf(stderr, "  -z size     msgsize: message bytes from layer 5, n or min:max (default the mss)\n");
+  fprintf(stderr, "  -s values   seed: random number generator seed (default 9999)\n");
+  fprintf(stderr, "  -r count    replications: independent runs of each combination (default 1)\n");
+  fprintf(stderr, "  -t level    trace: TRACE level (default 0)\n");
+  fprintf(stderr, "  -b file     log: write a binary event log (read it with tracedump)\n");
+  fprintf(stderr, "  -e engine   engine: future event set, heap or list (default heap)\n");
+  fprintf(stderr, "  -o format   output: text, csv or json (default text for a single run, csv for a sweep)\n");
+  fprintf(stderr, "  -j threads  threads: worker threads for a sweep (default one per core)\n");
+  fprintf(stderr, "  -f file     read parameters from a configuration file\n");
+  fprintf(stderr, "  -h          show this help\n");
+  fprintf(stderr, "values is a number, a comma separated list, or a range start:stop:step\n");
+  exit(EXIT_FAILURE);
+}
+
+static void badvalue(const char *key, const char *value, const char *where)
+{
+  fprintf(stderr, "%s: invalid value '%s' for %s\n", where, value, key);
+  exit(EXIT_FAILURE);
+}
+
+/* parse a single number, the whole string must be used */
+static int parsenumber(const char *str, double *x)
+{
+  char *end;
+
+  *x = strtod(str, &end);
+  return end != str && *end == '\0';
+}
+
+static void addvalue(struct valuelist *l, double x)
+{
+  if (l->n == l->size) {
+    l->size = l->size > 0 ? 2 * l->size : 8;
+    l->v = realloc(l->v, l->size * sizeof(double));
+    if (l->v == NULL) {
+      printf("memory allocation for parameter list failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  l->v[l->n++] = x;
+}
+
+/* parse "x", "x,y,..." or "start:stop:step" (items of a list may be ranges) */
+static void parselist(struct valuelist *l, const char *key, const char *value, const char *where)
+{
+  char buf[MAXLINE];
+  char *item, *next, *c1, *c2;
+  double start, stop, step, count;
+  int i, n;
+
+  if (strlen(value) >= sizeof(buf))
+    badvalue(key, value, where);
+  strcpy(buf, value);
+  l->n = 0;
+  for (item = buf; item != NULL; item = next) {
+    next = strchr(item, ',');
+    if (next != NULL)
+      *next++ = '\0';
+    c1 = strchr(item, ':');
+    if (c1 == NULL) {
+      if (!parsenumber(item, &start))
+        badvalue(key, value, where);
+      addvalue(l, start);
+      continue;
+    }
+    *c1++ = '\0';
+    c2 = strchr(c1, ':');
+    if (c2 == NULL)
+      badvalue(key, value, where);
+    *c2++ = '\0';
+    if (!parsenumber(item, &start) || !parsenumber(c1, &stop) ||
+        !parsenumber(c2, &step) || step <= 0.0 || stop < start)
+      badvalue(key, value, where);
+    /* also false for a range of infinite or NaN length */
+    count = (stop - start) / step + 1e-9;
+    if (!(count < MAXVALUES))
+      badvalue(key, value, where);
+    n = (int)count + 1;
+    for (i = 0; i < n; i++)
+      addvalue(l, start + i * step);
+  }
+}
+
+/* parse a seed, a whole number from 0 to 2^64-1 */
+static int parseseed(const char *str, unsigned long long *x)
+{
+  char *end;
+
+  while (isspace((unsigned char)*str))
+    str++;
+  if (*str == '-')              /* strtoull() would negate it */
+    return 0;
+  errno = 0;
+  *x = strtoull(str, &end, 10);
+  return end != str && *end == '\0' && errno != ERANGE;
+}
+
+static void addseed(struct seedlist *l, unsigned long long x)
+{
+  if (l->n == l->size) {
+    l->size = l->size > 0 ? 2 * l->size : 8;
+    l->v = realloc(l->v, l->size * sizeof(unsigned long long));
+    if (l->v == NULL) {
+      printf("memory allocation for parameter list failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  l->v[l->n++] = x;
+}
+
+/* parse seeds as parselist() does numbers, but exactly */
+static void parseseeds(struct seedlist *l, const char *key, const char *value, const char *where)
+{
+  char buf[MAXLINE];
+  char *item, *next, *c1, *c2;
+  unsigned long long start, stop, step, n, i;
+
+  if (strlen(value) >= sizeof(buf))
+    badvalue(key, value, where);
+  strcpy(buf, value);
+  l->n = 0;
+  for (item = buf; item != NULL; item = next) {
+    next = strchr(item, ',');
+    if (next != NULL)
+      *next++ = '\0';
+    c1 = strchr(item, ':');
+    if (c1 == NULL) {
+      if (!parseseed(item, &start))
+        badvalue(key, value, where);
+      addseed(l, start);
+      continue;
+    }
+    *c1++ = '\0';
+    c2 = strchr(c1, ':');
+    if (c2 == NULL)
+      badvalue(key, value, where);
+    *c2++ = '\0';
+    if (!parseseed(item, &start) || !parseseed(c1, &stop) ||
+        !parseseed(c2, &step) || step == 0 || stop < start)
+      badvalue(key, value, where);
+    n = (stop - start) / step + 1;
+    if (n > MAXVALUES)
+      badvalue(key, value, where);
+    for (i = 0; i < n; i++)
+      addseed(l, start + i * step);
+  }
+}
+
+/* parse a comma separated list of protocol names */
+static void parseprotocols(const char *key, const char *value, const char *where)
+{
+  char buf[MAXLINE];
+  char *item, *next;
+  int num;
+
+  if (strlen(value) >= sizeof(buf))
+    badvalue(key, value, where);
+  strcpy(buf, value);
+  protovals.n = 0;
+  for (item = buf; item != NULL; item = next) {
+    next = strchr(item, ',');
+    if (next != NULL)
+      *next++ = '\0';
+    if ((num = protocolnum(item)) < 0)
+      badvalue(key, value, where);
+    addvalue(&protovals, num);
+  }
+}
+
+/* a whole number that fits an int */
+static int parseint(const char *key, const char *value, const char *where)
+{
+  double x;
+
+  errno = 0;
+  if (!parsenumber(value, &x) || errno == ERANGE || x < INT_MIN || x > INT_MAX ||
+      x != (int)x)
+    badvalue(key, value, where);
+  return (int)x;
+}
+
+/* a count that may exceed an int, such as "2000000000" or "1e9" */
+static long long parsecount(const char *key, const char *value, const char *where)
+{
+  double x;
+
+  if (!parsenumber(value, &x) || x < 0 || x > 9007199254740992.0 ||
+      x != (long long)x)
+    badvalue(key, value, where);
+  return (long long)x;
+}
+
+/* a message size "n" or a uniform range "min:max" */
+static void parsesize(const char *key, const char *value, const char *where)
+{
+  char buf[MAXLINE];
+  char *colon;
+
+  if (strlen(value) >= sizeof(buf))
+    badvalue(key, value, where);
+  strcpy(buf, value);
+  colon = strchr(buf, ':');
+  if (colon != NULL)
+    *colon++ = '\0';
+  base.msgmin = parseint(key, buf, where);
+  base.msgmax = colon != NULL ? parseint(key, colon, where) : base.msgmin;
+  if (base.msgmin < 1 || base.msgmax < base.msgmin)
+    badvalue(key, value, where);
+}
+
+/* a probability from a loss model spec, or -1 if it is not one */
+static double parseprob(const char *str)
+{
+  double x;
+
+  if (!parsenumber(str, &x) || x < 0.0 || x > 1.0)
+    return -1.0;
+  return x;
+}
+
+static const char *lossmodelname(int model)
+{
+  if (model == LOSS_GILBERT)
+    return "gilbert";
+  if (model == LOSS_TRACE)
+    return "trace";
+  return "bernoulli";
+}
+
+/* "bernoulli", "gilbert:p:r[:good:bad]" or "trace:file[,file]" */
+static void parselossmodel(const char *key, const char *value, const char *where)
+{
+  struct lossconfig *l = &base.loss;
+  char buf[MAXLINE];
+  char *arg[4];
+  char *c, *comma;
+  int n;
+
+  if (strlen(value) >= sizeof(buf))
+    badvalue(key, value, where);
+  strcpy(buf, value);
+  if ((c = strchr(buf, ':')) != NULL)
+    *c++ = '\0';
+  if (strcmp(buf, "bernoulli") == 0 && c == NULL)
+    l->model = LOSS_BERNOULLI;
+  else if (strcmp(buf, "gilbert") == 0 && c != NULL) {
+    for (n = 0; n < 4 && c != NULL; n++) {
+      arg[n] = c;
+      if ((c = strchr(c, ':')) != NULL)
+        *c++ = '\0';
+    }
+    if (c != NULL || (n != 2 && n != 4))
+      badvalue(key, value, where);
+    l->model = LOSS_GILBERT;
+    l->p = parseprob(arg[0]);
+    l->r = parseprob(arg[1]);
+    l->lossgood = n == 4 ? parseprob(arg[2]) : 0.0;
+    l->lossbad = n == 4 ? parseprob(arg[3]) : 1.0;
+    if (l->p < 0 || l->r < 0 || l->lossgood < 0 || l->lossbad < 0)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(buf, "trace") == 0 && c != NULL && *c != '\0') {
+    l->model = LOSS_TRACE;
+    if ((comma = strchr(c, ',')) != NULL)
+      *comma++ = '\0';
+    if (*c == '\0' || (comma != NULL && *comma == '\0'))
+      badvalue(key, value, where);
+    l->trace[A] = strdup(c);
+    l->trace[B] = comma != NULL ? strdup(comma) : l->trace[A];
+  }
+  else
+    badvalue(key, value, where);
+}
+
+/* one link "rate:delay:queue" */
+static int parselinkspec(char *spec, struct linkconfig *l)
+{
+  char *c1, *c2, *end;
+
+  if ((c1 = strchr(spec, ':')) == NULL || (c2 = strchr(c1 + 1, ':')) == NULL)
+    return 0;
+  *c1++ = '\0';
+  *c2++ = '\0';
+  l->rate = strtod(spec, &end);
+  if (end == spec || *end != '\0' || l->rate <= 0)
+    return 0;
+  l->delay = strtod(c1, &end);
+  if (end == c1 || *end != '\0' || l->delay < 0)
+    return 0;
+  l->queue = (int)strtol(c2, &end, 10);
+  return end != c2 && *end == '\0' && l->queue >= 0;
+}
+
+/* the link model, "rate:delay:queue" both ways or "A->B spec/B->A spec" */
+static void parselink(const char *key, const char *value, const char *where)
+{
+  char buf[MAXLINE];
+  char *slash;
+
+  if (strlen(value) >= sizeof(buf))
+    badvalue(key, value, where);
+  strcpy(buf, value);
+  slash = strchr(buf, '/');
+  if (slash != NULL)
+    *slash++ = '\0';
+  if (!parselinkspec(buf, &base.link[A]))
+    badvalue(key, value, where);
+  if (slash == NULL)
+    base.link[B] = base.link[A];
+  else if (!parselinkspec(slash, &base.link[B]))
+    badvalue(key, value, where);
+}
+
+/* apply one parameter given by its long name */
+static void setoption(const char *key, const char *value, const char *where)
+{
+  int i;
+
+  if (strcmp(key, "protocol") == 0)
+    parseprotocols(key, value, where);
+  else if (strcmp(key, "messages") == 0)
+    base.nsimmax = parsecount(key, value, where);
+  else if (strcmp(key, "loss") == 0)
+    parselist(&lossvals, key, value, where);
+  else if (strcmp(key, "corrupt") == 0)
+    parselist(&corruptvals, key, value, where);
+  else if (strcmp(key, "direction") == 0) {
+    base.corruptdirection = parseint(key, value, where);
+    if (base.corruptdirection < 0 || base.corruptdirection > 2)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "lambda") == 0)
+    parselist(&lambdavals, key, value, where);
+  else if (strcmp(key, "link") == 0)
+    parselink(key, value, where);
+  else if (strcmp(key, "lossmodel") == 0)
+    parselossmodel(key, value, where);
+  else if (strcmp(key, "window") == 0) {
+    parselist(&windowvals, key, value, where);
+    for (i = 0; i < windowvals.n; i++)
+      if (windowvals.v[i] < 1 || windowvals.v[i] != (int)windowvals.v[i])
+        badvalue(key, value, where);
+  }
+  else if (strcmp(key, "seqspace") == 0) {
+    base.proto.seqspace = parseint(key, value, where);
+    if (base.proto.seqspace < 0)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "timeout") == 0) {
+    if (strcmp(value, "fixed") == 0)
+      base.proto.adaptive_rto = 0;
+    else if (strcmp(value, "adaptive") == 0)
+      base.proto.adaptive_rto = 1;
+    else
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "congestion") == 0) {
+    if (strcmp(value, "off") == 0)
+      base.proto.congestion = 0;
+    else if (strcmp(value, "aimd") == 0)
+      base.proto.congestion = 1;
+    else
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "dupacks") == 0) {
+    base.proto.dupthresh = parseint(key, value, where);
+    if (base.proto.dupthresh < 0)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "checksum") == 0) {
+    if ((base.proto.checksum = checksumkind(value)) < 0)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "traffic") == 0) {
+    if (strcmp(value, "simplex") == 0)
+      base.proto.bidirectional = 0;
+    else if (strcmp(value, "duplex") == 0)
+      base.proto.bidirectional = 1;
+    else
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "acks") == 0) {
+    if (strcmp(value, "single") == 0)
+      base.proto.sack = 0;
+    else if (strcmp(value, "sack") == 0)
+      base.proto.sack = 1;
+    else
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "ackevery") == 0) {
+    base.proto.ackevery = parseint(key, value, where);
+    if (base.proto.ackevery < 1)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "ackdelay") == 0) {
+    if (!parsenumber(value, &base.proto.ackdelay) || base.proto.ackdelay < 0)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "mss") == 0) {
+    base.proto.mss = parseint(key, value, where);
+    if (base.proto.mss < 1 || base.proto.mss > 65536)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "msgsize") == 0)
+    parsesize(key, value, where);
+  else if (strcmp(key, "seed") == 0)
+    parseseeds(&seedvals, key, value, where);
+  else if (strcmp(key, "replications") == 0) {
+    replications = parseint(key, value, where);
+    if (replications < 1)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "trace") == 0)
+    TRACE = parseint(key, value, where);
+  else if (strcmp(key, "log") == 0) {
+    /* the log is written where the trace is, which TRACE_MAX=0 leaves out */
+    if (TRACE_MAX < 1) {
+      fprintf(stderr, "%s: event logs are not built in (TRACE_MAX=%d)\n", where, TRACE_MAX);
+      exit(EXIT_FAILURE);
+    }
+    free(logfile);
+    logfile = strdup(value);
+  }
+  else if (strcmp(key, "engine") == 0) {
+    if ((base.engine = fesengine(value)) < 0)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "threads") == 0) {
+    nthreads = parseint(key, value, where);
+    if (nthreads < 0)
+      badvalue(key, value, where);
+  }
+  else if (strcmp(key, "output") == 0) {
+    if (strcmp(value, "text") == 0)
+      outformat = OUT_TEXT;
+    else if (strcmp(value, "csv") == 0)
+      outformat = OUT_CSV;
+    else if (strcmp(value, "json") == 0)
+      outformat = OUT_JSON;
+    else
+      badvalue(key, value, where);
+  }
+  else {
+    fprintf(stderr, "%s: unknown parameter '%s'\n", where, key);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static char *trim(char *s)
+{
+  char *end;
+
+  while (isspace((unsigned char)*s))
+    s++;
+  end = s + strlen(s);
+  while (end > s && isspace((unsigned char)end[-1]))
+    end--;
+  *end = '\0';
+  return s;
+}
+
+static void readconfig(const char *path)
+{
+  FILE *fp;
+  char line[MAXLINE], where[MAXLINE + 32];
+  char *key, *value, *p;
+  int lineno = 0;
+
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    if ((p = strchr(line, '#')) != NULL)
+      *p = '\0';
+    key = trim(line);
+    if (*key == '\0')
+      continue;
+    snprintf(where, sizeof(where), "%s:%d", path, lineno);
+    p = strchr(key, '=');
+    if (p == NULL) {
+      fprintf(stderr, "%s: expected key = value\n", where);
+      exit(EXIT_FAILURE);
+    }
+    *p = '\0';
+    key = trim(key);
+    value = trim(p + 1);
+    setoption(key, value, where);
+  }
+  fclose(fp);
+}
+
+/* the original interactive dialogue */
+static void promptconfig(void)
+{
+  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%lld",&base.nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%lf",&base.lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%lf",&base.corruptprob);
+  if (base.lossprob != 0.0 || base.corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&base.corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  scanf("%lf",&base.lambda);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+}
+
+/* x per time unit of a run that lasted t */
+static double pertime(double x, double t)
+{
+  return t > 0.0 ? x / t : 0.0;
+}
+
+static double efficiency(const struct simresult *res)
+{
+  return res->bytes_wire > 0 ? (double)res->bytes_delivered / res->bytes_wire : 0.0;
+}
+
+/* the latency histogram, a line for each doubling that has any */
+static void printlatency(const struct latresult *lat)
+{
+  long long n;
+  int i, j;
+
+  printf("end-to-end latency of %lld messages: mean %f, min %f, max %f\n",
+         lat->n, lat->mean, lat->min, lat->max);
+  if (lat->n == 0)
+    return;
+  printf("latency percentiles: p50 %f, p90 %f, p99 %f, p99.9 %f\n",
+         lat->p50, lat->p90, lat->p99, lat->p999);
+  for (i = 0; i < LATBUCKETS; i += LATSUB) {
+    n = 0;
+    for (j = i > 0 ? i - LATSUB + 1 : 0; j <= i; j++)
+      n += lat->hist[j];
+    if (n > 0)
+      printf("  latency <= %-12g %10lld  (%5.1f%%)\n", latbound(i), n,
+             100.0 * n / lat->n);
+  }
+}
+
+static void printsummary(const struct simresult *res)
+{
+  printf(" Simulator terminated at time %f\n after attempting to send %lld msgs from layer5\n",res->time,res->nsim);
+  printf("number of messages dropped due to full window:  %lld \n", res->window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %lld \n", res->new_ACKs);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %lld \n", res->packets_resent);
+  if (res->fast_retransmits > 0)
+    printf("number of fast retransmits by A (after duplicate ACKs):  %lld \n", res->fast_retransmits);
+  printf("number of correct packets received at B:  %lld \n", res->packets_received);
+  printf("number of messages delivered to application:  %lld \n", res->messages_delivered);
+  if (res->nlost > 0)
+    printf("packets lost: %lld, in %lld burst(s) of mean length %f\n",
+           res->nlost, res->lossbursts, (double)res->nlost / res->lossbursts);
+  printf("acknowledgements: %lld sent alone, %lld piggybacked on data\n",
+         res->acks_sent, res->acks_piggybacked);
+  printf("round trip time at A: srtt %f, rttvar %f, timeout %f (%lld samples)\n",
+         res->srtt, res->rttvar, res->rto, res->rtt_samples);
+  printf("bytes: %lld offered by layer 5, %lld sent into layer 3, %lld delivered to application\n",
+         res->bytes_fromlayer5, res->bytes_tolayer3, res->bytes_delivered);
+  printf("throughput: %f bits per time unit into layer 3; goodput: %f messages (%f bits) per time unit delivered\n",
+         pertime(8.0 * res->bytes_wire, res->time),
+         pertime(res->messages_delivered, res->time),
+         pertime(8.0 * res->bytes_delivered, res->time));
+  printf("channel efficiency: %f (bytes delivered per byte sent, %d byte headers included)\n",
+         efficiency(res), HEADERBYTES);
+  printlatency(&res->latency);
+  if (res->link[A].peak > 0)
+    printf("link A->B: utilization %f, queue mean %f, peak %d, %lld dropped at the tail\n",
+           res->link[A].utilization, res->link[A].mean, res->link[A].peak, res->link[A].drops);
+  if (res->link[B].peak > 0)
+    printf("link B->A: utilization %f, queue mean %f, peak %d, %lld dropped at the tail\n",
+           res->link[B].utilization, res->link[B].mean, res->link[B].peak, res->link[B].drops);
+  if (res->cwnd_peak > 0)
+    printf("congestion window at A: peak %f, time average %f\n", res->cwnd_peak, res->cwnd_mean);
+  printf("event pool: %lld events handled, peak %d in use, %d slab(s) of %d (%lu bytes)\n",
+         res->events, res->evpeak, res->nevslabs, res->evslabsize, res->evpoolbytes);
+  printf("packet pool: peak %d in use, %d slab(s) of %d (%lu bytes)\n",
+         res->pktpeak, res->npktslabs, res->pktslabsize, res->pktpoolbytes);
+}
+
+/* csv and json rows are printed field by field: the same list of fields
+   gives the csv header (the names), csv rows and json objects */
+static int rowformat;                 /* OUT_CSV or OUT_JSON */
+static int rowheader;                 /* print the field names, not values */
+static int rowfields;                 /* fields printed so far in this row */
+
+static void field(const char *name, const char *fmt, ...)
+{
+  va_list ap;
+
+  if (rowfields++ > 0)
+    putchar(',');
+  if (rowheader) {
+    fputs(name, stdout);
+    return;
+  }
+  if (rowformat == OUT_JSON)
+    printf("\"%s\":", name);
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+}
+
+/* a field whose value is a word, quoted in json */
+static void wordfield(const char *name, const char *value)
+{
+  field(name, rowformat == OUT_JSON ? "\"%s\"" : "%s", value);
+}
+
+static void printrow(const struct simconfig *cfg, const struct simresult *res,
+                     int format, int header)
+{
+  long long n;
+  int i;
+
+  rowformat = format;
+  rowheader = header;
+  rowfields = 0;
+  if (format == OUT_JSON)
+    putchar('{');
+  wordfield("protocol", protocolname(cfg->protocol));
+  field("messages", "%lld", cfg->nsimmax);
+  field("loss", "%g", cfg->lossprob);
+  field("corrupt", "%g", cfg->corruptprob);
+  wordfield("lossmodel", lossmodelname(cfg->loss.model));
+  field("ge_p", "%g", cfg->loss.p);
+  field("ge_r", "%g", cfg->loss.r);
+  field("ge_good", "%g", cfg->loss.lossgood);
+  field("ge_bad", "%g", cfg->loss.lossbad);
+  field("direction", "%d", cfg->corruptdirection);
+  field("lambda", "%g", cfg->lambda);
+  field("rate_ab", "%g", cfg->link[A].rate);
+  field("delay_ab", "%g", cfg->link[A].delay);
+  field("queue_ab", "%d", cfg->link[A].queue);
+  field("rate_ba", "%g", cfg->link[B].rate);
+  field("delay_ba", "%g", cfg->link[B].delay);
+  field("queue_ba", "%d", cfg->link[B].queue);
+  field("window", "%d", cfg->proto.windowsize);
+  field("seqspace", "%d", cfg->proto.seqspace);
+  wordfield("timeout", cfg->proto.adaptive_rto ? "adaptive" : "fixed");
+  wordfield("congestion", cfg->proto.congestion ? "aimd" : "off");
+  field("dupacks", "%d", cfg->proto.dupthresh);
+  wordfield("checksum", checksumname(cfg->proto.checksum));
+  wordfield("traffic", cfg->proto.bidirectional ? "duplex" : "simplex");
+  wordfield("acks", cfg->proto.sack ? "sack" : "single");
+  field("ackevery", "%d", cfg->proto.ackevery);
+  field("ackdelay", "%g", cfg->proto.ackdelay);
+  field("mss", "%d", cfg->proto.mss);
+  field("msgmin", "%d", cfg->msgmin);
+  field("msgmax", "%d", cfg->msgmax);
+  field("seed", "%llu", cfg->seed);
+  field("replication", "%d", cfg->replication);
+  field("end_time", "%f", res->time);
+  field("msgs_sent", "%lld", res->nsim);
+  field("window_full", "%lld", res->window_full);
+  field("acks_received", "%lld", res->total_ACKs_received);
+  field("new_acks", "%lld", res->new_ACKs);
+  field("packets_resent", "%lld", res->packets_resent);
+  field("fast_retransmits", "%lld", res->fast_retransmits);
+  field("packets_received", "%lld", res->packets_received);
+  field("messages_delivered", "%lld", res->messages_delivered);
+  field("tolayer3", "%lld", res->ntolayer3);
+  field("lost", "%lld", res->nlost);
+  field("loss_bursts", "%lld", res->lossbursts);
+  field("corrupted", "%lld", res->ncorrupt);
+  field("bytes_offered", "%lld", res->bytes_fromlayer5);
+  field("bytes_sent", "%lld", res->bytes_tolayer3);
+  field("bytes_delivered", "%lld", res->bytes_delivered);
+  field("bytes_wire", "%lld", res->bytes_wire);
+  field("throughput", "%f", pertime(8.0 * res->bytes_wire, res->time));
+  field("goodput", "%f", pertime(res->messages_delivered, res->time));
+  field("goodput_bits", "%f", pertime(8.0 * res->bytes_delivered, res->time));
+  field("efficiency", "%f", efficiency(res));
+  field("latency_n", "%lld", res->latency.n);
+  field("latency_mean", "%f", res->latency.mean);
+  field("latency_min", "%f", res->latency.min);
+  field("latency_max", "%f", res->latency.max);
+  field("latency_p50", "%f", res->latency.p50);
+  field("latency_p90", "%f", res->latency.p90);
+  field("latency_p99", "%f", res->latency.p99);
+  field("latency_p999", "%f", res->latency.p999);
+  field("acks_sent", "%lld", res->acks_sent);
+  field("acks_piggybacked", "%lld", res->acks_piggybacked);
+  field("qdrops_ab", "%lld", res->link[A].drops);
+  field("qpeak_ab", "%d", res->link[A].peak);
+  field("qmean_ab", "%f", res->link[A].mean);
+  field("util_ab", "%f", res->link[A].utilization);
+  field("qdrops_ba", "%lld", res->link[B].drops);
+  field("qpeak_ba", "%d", res->link[B].peak);
+  field("qmean_ba", "%f", res->link[B].mean);
+  field("util_ba", "%f", res->link[B].utilization);
+  field("srtt", "%f", res->srtt);
+  field("rttvar", "%f", res->rttvar);
+  field("rto", "%f", res->rto);
+  field("rtt_samples", "%lld", res->rtt_samples);
+  field("cwnd_peak", "%f", res->cwnd_peak);
+  field("cwnd_mean", "%f", res->cwnd_mean);
+  field("events", "%lld", res->events);
+  if (format == OUT_JSON) {
+    /* the buckets that have any, as [upper end, count] pairs */
+    printf(",\"latency_histogram\":[");
+    for (i = 0, n = 0; i < LATBUCKETS; i++)
+      if (res->latency.hist[i] > 0)
+        printf("%s[%g,%lld]", n++ > 0 ? "," : "", latbound(i), res->latency.hist[i]);
+    printf("]}");
+  }
+  putchar('\n');
+}
+
+/* results compared between protocols */
+static double goodput(const struct simresult *res)
+{
+  return pertime(res->messages_delivered, res->time);
+}
+
+static double delivered(const struct simresult *res)
+{
+  return res->messages_delivered;
+}
+
+static double resent(const struct simresult *res)
+{
+  return res->packets_resent;
+}
+
+static double latencymean(const struct simresult *res)
+{
+  return res->latency.mean;
+}
+
+static double latencyp99(const struct simresult *res)
+{
+  return res->latency.p99;
+}
+
+static const struct metric {
+  const char *name;
+  double (*value)(const struct simresult *);
+} metrics[] = {
+  { "goodput", goodput },
+  { "messages_delivered", delivered },
+  { "packets_resent", resent },
+  { "efficiency", efficiency },
+  { "latency_mean", latencymean },
+  { "latency_p99", latencyp99 },
+};
+
+/* the 97.5% point of Student's t distribution with df degrees of
+   freedom, from a table and then a Cornish-Fisher expansion */
+static double tquantile(int df)
+{
+  static const double t[] = {
+    0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+    2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+    2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+  const double z = 1.959964;
+
+  if (df <= 30)
+    return t[df];
+  return z + (z * z * z + z) / (4.0 * df) +
+         (5 * z * z * z * z * z + 16 * z * z * z + 3 * z) / (96.0 * df * df);
+}
+
+/* print half the width of a 95% confidence interval, or "-" if there
+   are too few runs to tell */
+static void printci(int df, double var, int n)
+{
+  char buf[32];
+
+  if (df < 1)
+    strcpy(buf, "-");
+  else
+    snprintf(buf, sizeof(buf), "+-%.3g", tquantile(df) * sqrt(var / n));
+  printf(" %13s", buf);
+}
+
+/* the comparison of the protocols in each combination.  The jobs of a
+   combination come together, each seed and replication once for every
+   protocol in turn, so job k * nprotos + p of a combination is run k of
+   protocol p. */
+static void printcompare(void)
+{
+  const struct metric *m;
+  const struct job *first;
+  int nprotos = protovals.n;
+  int nruns = seedvals.n * replications;
+  double x0, x, sum0, sumsq0, sum, sumsq, dsum, dsumsq, mean0, mean, dmean;
+  char diff[32];
+  int g, p, k;
+
+  for (g = 0; g < njobs / (nprotos * nruns); g++) {
+    first = jobs + g * nprotos * nruns;
+    if (g > 0)
+      putchar('\n');
+    printf("loss %g, corrupt %g, lambda %g, window %d: %d run(s) of each protocol\n",
+           first->cfg.lossprob, first->cfg.corruptprob, first->cfg.lambda,
+           first->cfg.proto.windowsize, nruns);
+    printf("%-20s %13s", "", protocolname(first[0].cfg.protocol));
+    for (p = 1; p < nprotos; p++)
+      printf(" %13s", protocolname(first[p].cfg.protocol));
+    for (p = 1; p < nprotos; p++) {
+      snprintf(diff, sizeof(diff), "%s-%s", protocolname(first[p].cfg.protocol),
+               protocolname(first[0].cfg.protocol));
+      printf(" %13s %13s %13s", diff, "paired 95%", "unpaired 95%");
+    }
+    putchar('\n');
+    for (m = metrics; m < metrics + sizeof(metrics) / sizeof(metrics[0]); m++) {
+      printf("%-20s", m->name);
+      for (p = 0; p < nprotos; p++) {
+        sum = 0.0;
+        for (k = 0; k < nruns; k++)
+          sum += m->value(&first[k * nprotos + p].res);
+        printf(" %13g", sum / nruns);
+      }
+      for (p = 1; p < nprotos; p++) {
+        sum0 = sumsq0 = sum = sumsq = dsum = dsumsq = 0.0;
+        for (k = 0; k < nruns; k++) {
+          x0 = m->value(&first[k * nprotos].res);
+          x = m->value(&first[k * nprotos + p].res);
+          sum0 += x0;
+          sumsq0 += x0 * x0;
+          sum += x;
+          sumsq += x * x;
+          dsum += x - x0;
+          dsumsq += (x - x0) * (x - x0);
+        }
+        mean0 = sum0 / nruns;
+        mean = sum / nruns;
+        dmean = dsum / nruns;
+        printf(" %13g", dmean);
+        if (nruns < 2) {
+          printci(0, 0.0, nruns);
+          printci(0, 0.0, nruns);
+          continue;
+        }
+        /* the variance of the differences, and the sum of the variances */
+        printci(nruns - 1, (dsumsq - nruns * dmean * dmean) / (nruns - 1), nruns);
+        printci(2 * nruns - 2, (sumsq0 - nruns * mean0 * mean0 +
+                                sumsq - nruns * mean * mean) / (nruns - 1), nruns);
+      }
+      putchar('\n');
+    }
+  }
+}
+
+static void *worker(void *arg)
+{
+  int i;
+
+  (void)arg;
+  for (;;) {
+    pthread_mutex_lock(&joblock);
+    i = nextjob++;
+    pthread_mutex_unlock(&joblock);
+    if (i >= njobs)
+      return NULL;
+    runsim(&jobs[i].cfg, &jobs[i].res);
+  }
+}
+
+/* run every job, using the calling thread as one of the workers */
+static void runjobs(void)
+{
+  pthread_t *tids;
+  int i;
+
+  if (nthreads == 0)
+    nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (TRACE > 0)
+    nthreads = 1;               /* keep the trace output in one piece */
+  if (nthreads > njobs)
+    nthreads = njobs;
+  if (nthreads < 1)
+    nthreads = 1;
+  tids = malloc(nthreads * sizeof(pthread_t));
+  if (tids == NULL) {
+    printf("memory allocation for threads failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 1; i < nthreads; i++)
+    if (pthread_create(&tids[i], NULL, worker, NULL) != 0) {
+      fprintf(stderr, "cannot create worker thread\n");
+      exit(EXIT_FAILURE);
+    }
+  worker(NULL);
+  for (i = 1; i < nthreads; i++)
+    pthread_join(tids[i], NULL);
+  free(tids);
+}
+
+/* the number of runs in the sweep, every combination of the lists */
+static int countruns(void)
+{
+  int counts[] = { lossvals.n, corruptvals.n, lambdavals.n, windowvals.n,
+                   seedvals.n, replications, protovals.n };
+  long long n = 1;
+  int i;
+
+  /* each count is at most an int, so checking as it grows cannot overflow */
+  for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); i++) {
+    n *= counts[i];
+    if (n > MAXRUNS) {
+      fprintf(stderr, "too many runs: a sweep can have at most %d\n", MAXRUNS);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return (int)n;
+}
+
+static void setdefault(struct valuelist *l, double x)
+{
+  if (l->n == 0)
+    addvalue(l, x);
+}
+
+int main(int argc, char *argv[])
+{
+  struct job *job;
+  char *name;
+  int opt, nruns, defproto, i;
+  int il, ic, im, iw, is, ir, ip;
+
+  base.nsimmax = 1000;
+  base.corruptdirection = 2;
+  base.seed = 9999;
+  base.proto.mss = 20;
+  base.proto.ackevery = 1;
+
+  /* the program name picks the protocol, unless -p does */
+  name = strrchr(argv[0], '/');
+  defproto = protocolnum(name != NULL ? name + 1 : argv[0]);
+  if (defproto < 0)
+    defproto = 0;
+
+  if (argc == 1) {
+    base.corruptdirection = 0;
+    promptconfig();
+    addvalue(&lossvals, base.lossprob);
+    addvalue(&corruptvals, base.corruptprob);
+    addvalue(&lambdavals, base.lambda);
+  }
+  else {
+    TRACE = 0;
+    while ((opt = getopt(argc, argv, "p:n:l:c:g:d:m:L:w:q:T:C:F:k:x:a:E:D:M:z:s:r:t:b:e:o:j:f:h")) != -1) {
+      switch (opt) {
+      case 'p': setoption("protocol", optarg, "-p"); break;
+      case 'n': setoption("messages", optarg, "-n"); break;
+      case 'l': setoption("loss", optarg, "-l"); break;
+      case 'c': setoption("corrupt", optarg, "-c"); break;
+      case 'g': setoption("lossmodel", optarg, "-g"); break;
+      case 'd': setoption("direction", optarg, "-d"); break;
+      case 'm': setoption("lambda", optarg, "-m"); break;
+      case 'L': setoption("link", optarg, "-L"); break;
+      case 'w': setoption("window", optarg, "-w"); break;
+      case 'q': setoption("seqspace", optarg, "-q"); break;
+      case 'T': setoption("timeout", optarg, "-T"); break;
+      case 'C': setoption("congestion", optarg, "-C"); break;
+      case 'F': setoption("dupacks", optarg, "-F"); break;
+      case 'k': setoption("checksum", optarg, "-k"); break;
+      case 'x': setoption("traffic", optarg, "-x"); break;
+      case 'a': setoption("acks", optarg, "-a"); break;
+      case 'E': setoption("ackevery", optarg, "-E"); break;
+      case 'D': setoption("ackdelay", optarg, "-D"); break;
+      case 'M': setoption("mss", optarg, "-M"); break;
+      case 'z': setoption("msgsize", optarg, "-z"); break;
+      case 's': setoption("seed", optarg, "-s"); break;
+      case 'r': setoption("replications", optarg, "-r"); break;
+      case 't': setoption("trace", optarg, "-t"); break;
+      case 'b': setoption("log", optarg, "-b"); break;
+      case 'e': setoption("engine", optarg, "-e"); break;
+      case 'o': setoption("output", optarg, "-o"); break;
+      case 'j': setoption("threads", optarg, "-j"); break;
+      case 'f': readconfig(optarg); break;
+      default: usage(argv[0]);
+      }
+    }
+    if (optind != argc)
+      usage(argv[0]);
+  }
+  if (base.msgmin == 0)
+    base.msgmin = base.msgmax = base.proto.mss;
+  if (base.msgmax > base.proto.mss) {
+    fprintf(stderr, "msgsize: messages of up to %d bytes do not fit an mss of %d\n",
+            base.msgmax, base.proto.mss);
+    exit(EXIT_FAILURE);
+  }
+  setdefault(&lossvals, 0.0);
+  for (i = 0; i < lossvals.n; i++)
+    if (base.loss.model != LOSS_BERNOULLI && lossvals.v[i] != 0.0) {
+      fprintf(stderr, "loss: a loss probability only applies to the bernoulli loss model\n");
+      exit(EXIT_FAILURE);
+    }
+  setdefault(&corruptvals, 0.0);
+  setdefault(&lambdavals, 10.0);
+  setdefault(&windowvals, 6);
+  if (seedvals.n == 0)
+    addseed(&seedvals, base.seed);
+  setdefault(&protovals, defproto);
+
+  nruns = countruns();
+  if (outformat == OUT_DEFAULT)
+    outformat = nruns > 1 && protovals.n == 1 ? OUT_CSV : OUT_TEXT;
+  if (outformat == OUT_CSV)
+    printrow(&base, &noresult, OUT_CSV, 1);
+
+  jobs = malloc((size_t)nruns * sizeof(struct job));
+  if (jobs == NULL) {
+    printf("memory allocation for runs failed.");
+    exit(EXIT_FAILURE);
+  }
+  job = jobs;
+  for (il = 0; il < lossvals.n; il++)
+    for (ic = 0; ic < corruptvals.n; ic++)
+      for (im = 0; im < lambdavals.n; im++)
+        for (iw = 0; iw < windowvals.n; iw++)
+          for (is = 0; is < seedvals.n; is++)
+            for (ir = 0; ir < replications; ir++)
+              for (ip = 0; ip < protovals.n; ip++) {
+                job->cfg = base;
+                job->cfg.protocol = (int)protovals.v[ip];
+                job->cfg.lossprob = lossvals.v[il];
+                job->cfg.corruptprob = corruptvals.v[ic];
+                job->cfg.lambda = lambdavals.v[im];
+                job->cfg.proto.windowsize = (int)windowvals.v[iw];
+                job->cfg.seed = seedvals.v[is];
+                job->cfg.replication = ir;
+                job++;
+              }
+  njobs = nruns;
+  if (logfile != NULL)
+    for (job = jobs; job < jobs + njobs; job++) {
+      if (njobs == 1) {
+        job->cfg.logfile = logfile;
+        continue;
+      }
+      name = malloc(strlen(logfile) + 16);
+      if (name == NULL) {
+        printf("memory allocation for log name failed.");
+        exit(EXIT_FAILURE);
+      }
+      sprintf(name, "%s.%d", logfile, (int)(job - jobs));
+      job->cfg.logfile = name;
+    }
+  runjobs();
+
+  if (outformat == OUT_TEXT && protovals.n > 1)
+    printcompare();
+  else
+    for (job = jobs; job < jobs + njobs; job++) {
+      if (outformat == OUT_CSV || outformat == OUT_JSON)
+        printrow(&job->cfg, &job->res, outformat, 0);
+      else
+        printsummary(&job->res);
+    }
+  free(jobs);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+/* ******************************************************************
+   xoshiro256** 1.0 by David Blackman and Sebastiano Vigna (public
+   domain), with splitmix64 to expand a 64-bit seed into the 256-bit
+   state and the published jump polynomials for 2^128 and 2^192 steps.
+**********************************************************************/
+#include "rng.h"
+
+static uint64_t rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+void rng_seed(struct rng *r, uint64_t seed)
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+    r->s[i] = splitmix64(&seed);
+}
+
+uint64_t rng_next(struct rng *r)
+{
+  uint64_t *s = r->s;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+  return result;
+}
+
+double rng_uniform(struct rng *r)
+{
+  return (rng_next(r) >> 11) * 0x1.0p-53;
+}
+
+void rng_fill(struct rng *r, double *out, int n)
+{
+  struct rng g = *r;             /* work on a local copy of the state */
+  int i;
+
+  for (i = 0; i < n; i++)
+    out[i] = (rng_next(&g) >> 11) * 0x1.0p-53;
+  *r = g;
+}
+
+static void jump(struct rng *r, const uint64_t poly[4])
+{
+  uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  int i, b;
+
+  for (i = 0; i < 4; i++)
+    for (b = 0; b < 64; b++) {
+      if (poly[i] & (1ULL << b)) {
+        s0 ^= r->s[0];
+        s1 ^= r->s[1];
+        s2 ^= r->s[2];
+        s3 ^= r->s[3];
+      }
+      rng_next(r);
+    }
+  r->s[0] = s0;
+  r->s[1] = s1;
+  r->s[2] = s2;
+  r->s[3] = s3;
+}
+
+void rng_jump(struct rng *r)
+{
+  static const uint64_t poly[4] = {
+    0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+    0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+  };
+
+  jump(r, poly);
+}
+
+void rng_longjump(struct rng *r)
+{
+  static const uint64_t poly[4] = {
+    0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+    0x77710069854ee241ULL, 0x39109bb02acbe635ULL
+  };
+
+  jump(r, poly);
+}
@@ -0,0 +1,26 @@
+/* Random number streams for the emulator: xoshiro256** seeded through
+   splitmix64.  A generator can jump ahead 2^128 or 2^192 draws, which
+   splits one seed into non-overlapping streams. */
+#include <stdint.h>
+
+struct rng {
+  uint64_t s[4];
+};
+
+/* initialise a generator from a 64-bit seed */
+extern void rng_seed(struct rng *r, uint64_t seed);
+
+/* next 64 random bits */
+extern uint64_t rng_next(struct rng *r);
+
+/* uniform double in [0,1) with 53 random bits */
+extern double rng_uniform(struct rng *r);
+
+/* fill out[0..n-1] with uniform doubles in [0,1) */
+extern void rng_fill(struct rng *r, double *out, int n);
+
+/* advance the generator by 2^128 draws */
+extern void rng_jump(struct rng *r);
+
+/* advance the generator by 2^192 draws */
+extern void rng_longjump(struct rng *r);
@@ -0,0 +1,55 @@
+/* Retransmission timeout estimation, see rto.h */
+#include <stdlib.h>
+#include "emulator.h"
+#include "rto.h"
+
+void rto_init(struct rto *r, int adaptive, double initial)
+{
+  r->adaptive = adaptive;
+  r->initial = initial;
+  r->srtt = 0.0;
+  r->rttvar = 0.0;
+  r->rto = initial;
+  r->samples = 0;
+}
+
+void rto_sample(struct rto *r, double rtt)
+{
+  double err;
+
+  if (r->samples == 0) {
+    r->srtt = rtt;
+    r->rttvar = rtt / 2;
+  }
+  else {
+    err = rtt - r->srtt;
+    r->srtt += err / 8;
+    r->rttvar += ((err < 0 ? -err : err) - r->rttvar) / 4;
+  }
+  r->samples++;
+  r->rto = r->srtt + 4 * r->rttvar;
+  if (r->rto < RTO_MIN)
+    r->rto = RTO_MIN;
+  if (r->rto > RTO_MAX)
+    r->rto = RTO_MAX;
+}
+
+void rto_backoff(struct rto *r)
+{
+  r->rto *= 2;
+  if (r->rto > RTO_MAX)
+    r->rto = RTO_MAX;
+}
+
+double rto_timeout(const struct rto *r)
+{
+  return r->adaptive ? r->rto : r->initial;
+}
+
+void rto_report(const struct rto *r, struct simstats *stats)
+{
+  stats->srtt = r->srtt;
+  stats->rttvar = r->rttvar;
+  stats->rto = rto_timeout(r);
+  stats->rtt_samples = r->samples;
+}
@@ -0,0 +1,34 @@
+/* Retransmission timeout for the protocol senders.  With a fixed
+   timeout the sender always waits RTT.  With an adaptive one the timeout
+   follows Jacobson and Karels: a smoothed round trip time and its mean
+   deviation are updated from each sample, the timeout is
+   srtt + 4 * rttvar, and it doubles every time it expires until the next
+   sample.  By Karn's rule, callers only sample packets that were never
+   resent. */
+
+#define RTO_MIN 1.0         /* adaptive timeout never goes below ... */
+#define RTO_MAX 1024.0      /* ... or above these */
+
+struct rto {
+  int adaptive;             /* 0 = always the initial timeout */
+  double initial;           /* fixed timeout, and first adaptive one */
+  double srtt;              /* smoothed round trip time */
+  double rttvar;            /* round trip time variation */
+  double rto;               /* current timeout */
+  long long samples;        /* round trip times measured */
+};
+
+/* start with no samples and a timeout of 'initial' */
+extern void rto_init(struct rto *r, int adaptive, double initial);
+
+/* a packet sent once was acknowledged 'rtt' after it was sent */
+extern void rto_sample(struct rto *r, double rtt);
+
+/* the timer expired: back off */
+extern void rto_backoff(struct rto *r);
+
+/* the timeout to use for the next timer */
+extern double rto_timeout(const struct rto *r);
+
+/* copy the estimate to the simulation's statistics */
+extern void rto_report(const struct rto *r, struct simstats *stats);
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Checks that GBN's round trip time estimate stays near the real round
+# trip time when packets are lost and the congestion window makes it
+# resend only part of the window at a time.  Every ACK that could belong
+# to an old copy of a packet has to be left out of the estimate (Karn),
+# or srtt grows to hundreds of time units.
+#
+# The channel delays a packet by 1 to 10 time units each way, more when
+# packets queue behind each other, so srtt is well under $limit.
+#
+# usage: rtttest.sh [sim]
+
+sim=${1:-./sim}
+limit=40
+
+for dupacks in 0 3; do
+  $sim -p gbn -n 5000 -m 20 -T adaptive -C aimd -l 0.1,0.2,0.3 -w 6,20,50 \
+       -F $dupacks -s 1:4:1 -o csv
+done |
+awk -F, -v limit=$limit '
+$1 == "protocol" {
+  for (i = 1; i <= NF; i++)
+    col[$i] = i
+  next
+}
+{
+  runs++
+  if ($col["srtt"] > limit) {
+    printf "FAIL: loss %s window %s dupacks %s seed %s: srtt %s\n",
+           $col["loss"], $col["window"], $col["dupacks"], $col["seed"], $col["srtt"]
+    failed++
+  }
+}
+END {
+  if (runs == 0) {
+    print "FAIL: no runs"
+    exit 1
+  }
+  printf "%d of %d runs kept srtt under %d\n", runs - failed, runs, limit
+  exit failed > 0
+}'
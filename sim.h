@@ -0,0 +1,152 @@
+/* Interface between the emulator and the program that drives it (main.c).
+   Protocol code does not need anything from this file. */
+
+/* bytes a packet header takes on the wire: seqnum, acknum, checksum,
+   length and sacklen */
+#define HEADERBYTES 20
+
+/* A link carrying packets from one entity to the other.  A packet waits
+   in a FIFO queue for the transmitter, takes (header + payload bits) /
+   rate to send and arrives delay after that.  With rate 0 the channel
+   is the original one: each packet arrives a random 1 to 10 time units
+   after the one ahead of it. */
+struct linkconfig {
+  double rate;            /* bits per time unit, 0 = no link model */
+  double delay;           /* propagation delay */
+  int queue;              /* packets the queue holds, counting the one
+                             being sent; one more is dropped (tail drop).
+                             0 = no limit */
+};
+
+/* How the channel decides which packets are lost.  Each direction has
+   a loss process of its own, fed from its own random numbers.
+     bernoulli  each packet is lost with probability simconfig.lossprob,
+                independently of the others (the original channel).
+     gilbert    the Gilbert-Elliott channel: a two-state Markov chain
+                that moves, before each packet, from good to bad with
+                probability p and from bad to good with probability r.
+                A packet is lost with probability lossgood in the good
+                state and lossbad in the bad one, so losses come in bursts
+                of mean length 1/r (with lossgood 0 and lossbad 1).
+     trace      replay of recorded traces, one per direction.  A trace is a
+                text file with one line per packet: the packet's one-way
+                delay, or '-' if it was lost; '#' starts a comment.  The
+                packets keep their order, so a packet arrives after its
+                delay or just after the packet ahead of it, whichever is
+                later.  With a link model only the losses are replayed.  A
+                trace that runs out starts again from the top.  Traces are
+                mapped into memory, not read, and the part already replayed
+                is let go, so they can be of any size.  Only packets the
+                corruption direction lets be lost use up a line.
+   The corruption direction limits losses as well as corruption.
+   Corruption is always independent with probability corruptprob. */
+#define LOSS_BERNOULLI 0
+#define LOSS_GILBERT   1
+#define LOSS_TRACE     2
+
+struct lossconfig {
+  int model;              /* LOSS_* */
+  double p, r;            /* gilbert: P(good -> bad), P(bad -> good) */
+  double lossgood, lossbad; /* gilbert: loss probability in each state */
+  const char *trace[2];   /* trace: files for packets from A and from B */
+};
+
+/* parameters of one simulation run */
+struct simconfig {
+  long long nsimmax;      /* number of msgs to generate, then stop */
+  double lossprob;        /* probability that a packet is dropped  */
+  struct lossconfig loss; /* loss model, see above */
+  double corruptprob;     /* probability that one bit is packet is flipped */
+  int corruptdirection;   /* A->B A<-B or bidirectional corruption/loss */
+  double lambda;          /* average time between messages from layer 5 */
+  unsigned long long seed; /* seed for the random number generators */
+  int replication;        /* replication number, selects independent streams */
+  int protocol;           /* protocol to run, see protocolnum() */
+  int engine;             /* future event set engine, see fesengine() */
+  const char *logfile;    /* binary event log to write, or NULL */
+  int msgmin, msgmax;     /* message sizes from layer 5, in bytes */
+  struct linkconfig link[2]; /* links from A (to B) and from B (to A) */
+  struct protoconfig proto; /* handed to the protocol as sim.config */
+};
+
+/* what became of a link's queue */
+struct linkresult {
+  long long drops;        /* packets dropped at the tail of the queue */
+  int peak;               /* most packets ever in the queue */
+  double mean;            /* packets in the queue, averaged over time */
+  double utilization;     /* fraction of the time spent sending */
+};
+
+/* End-to-end latencies, from a message's arrival at layer 5 to its
+   delivery at the other side, are counted in log-spaced buckets: LATSUB
+   buckets to each doubling, the first ending at 2^LATEXPMIN and every
+   LATSUB-th after it at the next power of two.  Bucket i
+   holds latencies up to latbound(i), so a percentile read from them is
+   at most 1/LATSUB too high. */
+#define LATSUB     16
+#define LATEXPMIN  (-8)
+#define LATBUCKETS (40 * LATSUB + 1)
+
+extern double latbound(int i);
+
+struct latresult {
+  long long n;            /* messages delivered with a known arrival time */
+  double min, mean, max;
+  double p50, p90, p99, p999; /* percentiles, upper bounds of their buckets */
+  long long hist[LATBUCKETS];
+};
+
+/* statistics collected by one simulation run */
+struct simresult {
+  double time;            /* simulated time at which the run ended */
+  long long nsim;           /* messages passed from layer 5 to layer 4 */
+  long long window_full;    /* messages dropped due to full window */
+  long long total_ACKs_received;
+  long long new_ACKs;       /* acks correctly received */
+  long long packets_resent; /* packets resent by A */
+  long long packets_received; /* packets received by B */
+  long long messages_delivered; /* messages delivered to layer 5 */
+  long long ntolayer3;      /* packets sent into layer 3 */
+  long long nlost;          /* packets lost in the medium */
+  long long lossbursts;     /* runs of packets lost one after another */
+  long long ncorrupt;       /* packets corrupted by the medium */
+  long long bytes_fromlayer5; /* message bytes passed from layer 5 */
+  long long bytes_tolayer3; /* payload bytes sent into layer 3 */
+  long long bytes_delivered; /* message bytes delivered to layer 5 */
+  long long bytes_wire;     /* bytes sent into layer 3, headers included */
+  long long fast_retransmits; /* resends set off by duplicate ACKs */
+  long long acks_sent;    /* packets sent only to acknowledge */
+  long long acks_piggybacked; /* ACKs carried by data packets */
+  double srtt;            /* A's smoothed round trip time */
+  double rttvar;          /* A's round trip time variation */
+  double rto;             /* A's retransmission timeout at the end */
+  long long rtt_samples;  /* round trip times A measured */
+  double cwnd_peak;       /* A's largest congestion window (0 = none) */
+  double cwnd_mean;       /* A's congestion window averaged over time */
+  long long events;       /* events taken off the event set */
+  int evpeak;             /* peak number of events in use */
+  int nevslabs;           /* event slabs allocated */
+  int evslabsize;         /* events per slab */
+  unsigned long evpoolbytes; /* memory held by the event pool */
+  int pktpeak;            /* peak number of packet buffers in use */
+  int npktslabs;          /* packet slabs allocated */
+  int pktslabsize;        /* packets per slab */
+  unsigned long pktpoolbytes; /* memory held by the packet pool */
+  struct linkresult link[2]; /* links from A and from B, if modelled */
+  struct latresult latency; /* end-to-end latency of delivered messages */
+};
+
+/* look up a future event set engine ("heap" or "list") by name.
+   Returns the value for simconfig.engine, or -1 if there is no such engine. */
+extern int fesengine(const char *name);
+
+/* look up a protocol ("gbn" or "sr") by name.  Returns the value for
+   simconfig.protocol, or -1 if there is no such protocol. */
+extern int protocolnum(const char *name);
+
+/* the name of protocol 'num' */
+extern const char *protocolname(int num);
+
+/* run one simulation to completion.  Simulations share no state, so
+   several may run at the same time in different threads. */
+extern void runsim(const struct simconfig *cfg, struct simresult *res);
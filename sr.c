@@ -1,252 +1,665 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "emulator.h"
-#include "gbn.h"
+#include "sr.h"
+#include "rto.h"
+#include "checksum.h"
 
 #define RTT  16.0
-#define WINDOWSIZE 6
-#define SEQSPACE 7
+#define WINDOWSIZE 6     /* default window; the sequence space defaults to 2 * window */
 #define NOTINUSE (-1)
+#define MAXBACKOFF 6     /* with an adaptive timeout, a resent packet waits
+                            at most 2^MAXBACKOFF timeouts */
+#define ACKHOLD (RTT / 2)  /* how long an ACK waits for data to ride on or
+                              more packets to cover, unless config.ackdelay says */
 
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(struct sim *s, const struct pkt *packet)
 {
-  int checksum = 0;
-  int i;
+  return pkt_checksum(s->config.checksum, packet);
+}
 
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for (i = 0; i < 20; i++)
-    checksum += (int)(packet.payload[i]);
+static bool IsCorrupted(struct sim *s, const struct pkt *packet)
+{
+  return packet->checksum != ComputeChecksum(s, packet);
+}
 
-  return checksum;
+/* the window size and sequence space for this run.  Selective repeat
+   can only tell a new packet from a resent old one if the sequence space
+   is at least twice the window. */
+static void getwindow(struct sim *s, int *windowsize, int *seqspace)
+{
+  *windowsize = s->config.windowsize > 0 ? s->config.windowsize : WINDOWSIZE;
+  *seqspace = s->config.seqspace > 0 ? s->config.seqspace : 2 * *windowsize;
+  if (*seqspace < 2 * *windowsize) {
+    printf("SR needs a sequence space of at least twice the window size (window %d, seqspace %d)\n",
+           *windowsize, *seqspace);
+    exit(EXIT_FAILURE);
+  }
 }
 
-bool IsCorrupted(struct pkt packet)
+/* With config.bidirectional both ends send data as well as receive it,
+   so each end below is a sender and a receiver sharing one emulator
+   timer.  The ACKs an end owes wait in a queue for data packets going the
+   other way, each of which carries the oldest in its acknum field
+   (NOTINUSE if none is owed).  An ACK that finds no data to ride on
+   within ACKHOLD goes alone as a pure ACK, a packet with seqnum NOTINUSE
+   and no payload.  Sending one way only, B
+   acknowledges every packet at once, as it always has.
+
+   With config.sack an ACK describes the receiver rather than one packet:
+   acknum is the last packet delivered in order, and a bitmap after the
+   data (sacklen bytes) has bit i set if packet acknum + 1 + i is
+   buffered.  The sender marks everything an ACK covers in one pass, so a
+   lost ACK is made good by the next one.  An end then owes at most one
+   ACK, filled in when it goes.
+
+   config.ackevery > 1 delays ACKs, which needs config.sack: one ACK goes
+   for every ackevery packets that arrive in order, or ACKHOLD after the
+   first of them.  A packet out of order, a duplicate, one that fills a
+   gap or a corrupted one is ACKed at once, as the sender should hear of
+   it soon. */
+
+/********* Sender variables and functions ************/
+
+/* Every unacked packet in the window has its own logical timer, a
+   deadline in simulated time.  The deadlines are kept in a min-heap of
+   window slots and the emulator's single timer for the end is always
+   armed for the earliest one (or for the ACK hold deadline, if that is
+   sooner); when it fires, every packet whose deadline has passed is
+   resent and given a new deadline.  With a fixed timeout that is always
+   one timeout on; an adaptive one doubles for each time the packet has
+   expired since the last new ACK, standing in for rto_backoff(), which
+   would slow every packet down for one that is lost again.  A fixed
+   timeout shorter than the round trip time resends the whole window
+   every timeout and the channel never catches up, as with GBN: use the
+   adaptive timeout when messages come faster than the channel clears. */
+struct sender {
+  int windowsize;                   /* number of slots in the arrays below */
+  int seqspace;
+  struct pkt *buffer;
+  int windowfirst, windowlast;
+  int windowcount;
+  int A_nextseqnum;
+  bool *acked;
+  double *sendtime;                 /* when each slot's packet was first sent */
+  double *timer_expiry;             /* deadline of each slot's timer */
+  bool *resent;                     /* slot was resent, so not timed (Karn) */
+  int *retries;                     /* timeouts of each slot since a new ACK */
+  int *deadlines;                   /* heap of slots by timer_expiry */
+  int *heappos;                     /* slot's place in the heap, or -1 */
+  int ndeadlines;
+  struct rto rto;                   /* retransmission timeout */
+};
+
+/********* Receiver variables ************/
+
+/* The receiver buffers out of order packets that fall in its window, the
+   windowsize sequence numbers from expectedseqnum on.  recv_buffer is a
+   ring: the slot for expectedseqnum is recvfirst. */
+struct receiver {
+  int windowsize;
+  int seqspace;
+  int expectedseqnum;
+  int last_acked_seq;
+  struct pkt *recv_buffer;
+  bool *received;
+  int recvfirst;
+  int nbuffered;                    /* packets waiting for a gap to fill */
+};
+
+/* one end of the connection, A or B */
+struct entity {
+  int self;                         /* A or B */
+  char name;                        /* 'A' or 'B', for tracing */
+  bool hasdata;                     /* receives data, not only ACKs */
+  bool holdacks;                    /* ACKs may wait ... */
+  double ackhold;                   /* ... this long at most */
+  int unacked;                      /* packets the waiting ACK covers */
+  struct sender snd;
+  struct receiver rcv;
+  int *ackq;                        /* ring of ACKs waiting for data ... */
+  double *ackdue;                   /* ... and when each must go alone */
+  int ackfirst, ackcount, acksize;
+  bool timer_running;               /* the emulator timer is armed ... */
+  double timer_armed;               /* ... to go off at this time */
+};
+
+static void deadline_swap(struct sender *a, int i, int j)
 {
-  return packet.checksum != ComputeChecksum(packet);
+  int t = a->deadlines[i];
+
+  a->deadlines[i] = a->deadlines[j];
+  a->deadlines[j] = t;
+  a->heappos[a->deadlines[i]] = i;
+  a->heappos[a->deadlines[j]] = j;
 }
 
-/********* Sender (A) variables and functions ************/
+static bool deadline_before(struct sender *a, int i, int j)
+{
+  return a->timer_expiry[a->deadlines[i]] < a->timer_expiry[a->deadlines[j]];
+}
 
-static struct pkt buffer[WINDOWSIZE];
-static int windowfirst, windowlast;
-static int windowcount;
-static int A_nextseqnum;
-extern int packets_resent;
-static bool acked[WINDOWSIZE];
-static float timer_expiry[WINDOWSIZE];  
-static bool timer_active[WINDOWSIZE];   
-static float current_time = 0.0;      
-static int last_acked_seq = -1; 
+static void deadline_siftup(struct sender *a, int i)
+{
+  while (i > 0 && deadline_before(a, i, (i - 1) / 2)) {
+    deadline_swap(a, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
 
-void A_output(struct msg message)
+static void deadline_siftdown(struct sender *a, int i)
 {
-  struct pkt sendpkt;
-  int i;
+  int c;
+
+  for (;;) {
+    c = 2 * i + 1;
+    if (c >= a->ndeadlines)
+      break;
+    if (c + 1 < a->ndeadlines && deadline_before(a, c + 1, c))
+      c++;
+    if (!deadline_before(a, c, i))
+      break;
+    deadline_swap(a, i, c);
+    i = c;
+  }
+}
 
-  if (windowcount < WINDOWSIZE) {
-    if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+/* start the logical timer of window slot 'slot' */
+static void deadline_set(struct sender *a, int slot, double expiry)
+{
+  a->timer_expiry[slot] = expiry;
+  if (a->heappos[slot] < 0) {
+    a->heappos[slot] = a->ndeadlines;
+    a->deadlines[a->ndeadlines++] = slot;
+    deadline_siftup(a, a->heappos[slot]);
+  } else {
+    deadline_siftup(a, a->heappos[slot]);
+    deadline_siftdown(a, a->heappos[slot]);
+  }
+}
 
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for (i = 0; i < 20; i++)
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
+/* stop the logical timer of window slot 'slot' */
+static void deadline_clear(struct sender *a, int slot)
+{
+  int i = a->heappos[slot];
+  int moved;
+
+  if (i < 0)
+    return;
+  a->heappos[slot] = -1;
+  if (i != --a->ndeadlines) {
+    moved = a->deadlines[a->ndeadlines];
+    a->deadlines[i] = moved;
+    a->heappos[moved] = i;
+    deadline_siftup(a, i);
+    deadline_siftdown(a, a->heappos[moved]);
+  }
+}
 
-    windowlast = (windowfirst + windowcount) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    acked[windowlast] = false;
-    windowcount++;
+/* arm the end's emulator timer for its earliest deadline, if it is not
+   already */
+static void rearm(struct sim *s, struct entity *e)
+{
+  struct sender *a = &e->snd;
+  double next;
 
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3(A, sendpkt);
-    timer_expiry[windowlast] = current_time + RTT;
-    timer_active[windowlast] = true;
+  if (a->ndeadlines == 0 && e->ackcount == 0) {
+    if (e->timer_running) {
+      stoptimer(s, e->self);
+      e->timer_running = false;
+    }
+    return;
+  }
+  if (a->ndeadlines == 0)
+    next = e->ackdue[e->ackfirst];
+  else {
+    next = a->timer_expiry[a->deadlines[0]];
+    if (e->ackcount > 0 && e->ackdue[e->ackfirst] < next)
+      next = e->ackdue[e->ackfirst];
+  }
+  if (e->timer_running && e->timer_armed == next)
+    return;
+  if (e->timer_running)
+    stoptimer(s, e->self);
+  starttimer(s, e->self, next - s->time);
+  e->timer_running = true;
+  e->timer_armed = next;
+}
+
+/* put the ACK for packet 'acknum' in packet p, or with config.sack the
+   receiver's cumulative ACK and bitmap.  Trailing zero bytes of the
+   bitmap are left off, so an ACK with nothing out of order has none. */
+static void putack(struct sim *s, struct entity *e, struct pkt *p, int acknum)
+{
+  struct receiver *b = &e->rcv;
+  unsigned char *map = (unsigned char *)p->payload + p->length;
+  int i, nbits, found;
+
+  p->sacklen = 0;
+  e->unacked = 0;
+  if (!s->config.sack) {
+    p->acknum = acknum;
+    return;
+  }
+  p->acknum = (b->expectedseqnum - 1 + b->seqspace) % b->seqspace;
+  nbits = b->windowsize < 8 * s->config.sackroom ? b->windowsize : 8 * s->config.sackroom;
+  found = 0;
+  for (i = 0; i < nbits && found < b->nbuffered; i++) {
+    if (i % 8 == 0)
+      map[i / 8] = 0;
+    if (b->received[(b->recvfirst + i) % b->windowsize]) {
+      map[i / 8] |= 1 << (i % 8);
+      p->sacklen = i / 8 + 1;
+      found++;
+    }
+  }
+}
+
+/* send a packet with no data acknowledging packet 'acknum' */
+static void sendack(struct sim *s, struct entity *e, int acknum)
+{
+  struct pkt *ackpkt = pkt_alloc(s);
+
+  ackpkt->seqnum = NOTINUSE;
+  putack(s, e, ackpkt, acknum);
+  ackpkt->checksum = ComputeChecksum(s, ackpkt);
+  s->stats.acks_sent++;
+  tolayer3_send(s, e->self, ackpkt);
+}
 
+/* take the oldest waiting ACK off the queue */
+static int popack(struct entity *e)
+{
+  int acknum = e->ackq[e->ackfirst];
+
+  e->ackfirst = (e->ackfirst + 1) % e->acksize;
+  e->ackcount--;
+  return acknum;
+}
 
-    if (windowcount == 1)
-      starttimer(A, RTT);
+/* acknowledge packet 'acknum': at once if ACKs do not wait, otherwise
+   on a data packet out within ackhold or alone after it.  An ACK already
+   waiting for the same packet, or any ACK with config.sack, does for
+   both; if the queue is full its oldest ACK goes now.  Delaying ACKs,
+   the ACK goes at once after a gap or once it covers ackevery packets. */
+static void oweack(struct sim *s, struct entity *e, int acknum, bool gap)
+{
+  int i, slot;
+
+  if (!e->holdacks) {
+    sendack(s, e, acknum);
+    return;
+  }
+  if (s->config.ackevery > 1 && (gap || ++e->unacked >= s->config.ackevery)) {
+    if (e->ackcount > 0)
+      popack(e);
+    sendack(s, e, acknum);
+    rearm(s, e);
+    return;
+  }
+  if (s->config.sack && e->ackcount > 0)
+    return;
+  for (i = 0; i < e->ackcount; i++)
+    if (e->ackq[(e->ackfirst + i) % e->acksize] == acknum)
+      return;
+  if (e->ackcount == e->acksize)
+    sendack(s, e, popack(e));
+  slot = (e->ackfirst + e->ackcount) % e->acksize;
+  e->ackq[slot] = acknum;
+  e->ackdue[slot] = s->time + e->ackhold;
+  e->ackcount++;
+  rearm(s, e);
+}
 
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+/* send the packet in window slot 'slot', with the oldest waiting ACK if
+   there is one.  The window keeps its copy for resending; the emulator gets a
+   copy of its own. */
+static void sendslot(struct sim *s, struct entity *e, int slot)
+{
+  struct pkt *p = pkt_alloc(s);
+
+  pkt_copy(p, &e->snd.buffer[slot]);
+  if (e->ackcount > 0) {
+    putack(s, e, p, popack(e));
+    p->checksum = ComputeChecksum(s, p);
+    s->stats.acks_piggybacked++;
+    if (TRACE_ABOVE(0))
+      printf("----%c: ACK %d rides on packet %d\n", e->name, p->acknum, p->seqnum);
+  }
+  tolayer3_send(s, e->self, p);
+}
+
+static void output(struct sim *s, struct entity *e, struct msg message)
+{
+  struct sender *a = &e->snd;
+  struct pkt *sendpkt;
+
+  if (a->windowcount < a->windowsize) {
+    if (TRACE_ABOVE(1))
+      printf("----%c: New message arrives, send window is not full, send new messge to layer3!\n", e->name);
+
+    a->windowlast = (a->windowfirst + a->windowcount) % a->windowsize;
+    sendpkt = &a->buffer[a->windowlast];
+    sendpkt->seqnum = a->A_nextseqnum;
+    sendpkt->acknum = NOTINUSE;
+    sendpkt->length = message.length;
+    memcpy(sendpkt->payload, message.data, message.length);
+    sendpkt->checksum = ComputeChecksum(s, sendpkt);
+
+    a->acked[a->windowlast] = false;
+    a->resent[a->windowlast] = false;
+    a->retries[a->windowlast] = 0;
+    a->sendtime[a->windowlast] = s->time;
+    a->windowcount++;
+
+    if (TRACE_ABOVE(0))
+      printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+    sendslot(s, e, a->windowlast);
+    deadline_set(a, a->windowlast, s->time + rto_timeout(&a->rto));
+    rearm(s, e);
+
+    a->A_nextseqnum = (a->A_nextseqnum + 1) % a->seqspace;
   } else {
-    if (TRACE > 0)
-      printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    if (TRACE_ABOVE(0))
+      printf("----%c: New message arrives, send window is full\n", e->name);
+    s->stats.window_full++;
   }
 }
 
-void A_input(struct pkt packet)
+/* mark the packet 'offset' places into the send window as ACKed;
+   false if it already was */
+static bool ackslot(struct sender *a, int offset)
 {
-  int i, index;
-  bool has_unacked = false;
-  if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-    total_ACKs_received++;
+  int slot = (a->windowfirst + offset) % a->windowsize;
 
-    if (windowcount == 0)
-      return;
+  if (a->acked[slot])
+    return false;
+  a->acked[slot] = true;
+  deadline_clear(a, slot);
+  return true;
+}
 
-    index = windowfirst;
-    for (i = 0; i < windowcount; i++) {
-      if ((buffer[index].seqnum == packet.acknum) && (!acked[index])) {
-        if (!acked[index]) {
-          if (TRACE > 0)
-            printf("----A: ACK %d is not a duplicate\n", packet.acknum);
-          new_ACKs++;
-          acked[index] = true;
-          timer_active[index] = false;
-        } else {
-          if (TRACE > 0)
-            printf("----A: duplicate ACK received, do nothing!\n");
-        }
-        break;
+/* the sender's half of an incoming packet: its ACK */
+static void ackinput(struct sim *s, struct entity *e, const struct pkt *packet)
+{
+  struct sender *a = &e->snd;
+  const unsigned char *map;
+  int i, offset, newest, index;
+
+  if (TRACE_ABOVE(0))
+    printf("----%c: uncorrupted ACK %d is received\n", e->name, packet->acknum);
+  s->stats.total_ACKs_received++;
+
+  if (a->windowcount == 0 || packet->acknum < 0 || packet->acknum >= a->seqspace)
+    return;
+
+  /* where the ACKed packet is in the window; windowcount or more if it
+     is not there */
+  offset = (packet->acknum - a->buffer[a->windowfirst].seqnum + a->seqspace) % a->seqspace;
+  newest = -1;
+  if (!s->config.sack) {
+    if (offset < a->windowcount && ackslot(a, offset))
+      newest = offset;
+  } else {
+    /* everything up to acknum has arrived, and so has every packet
+       whose bit is set */
+    if (offset < a->windowcount)
+      for (i = 0; i <= offset; i++)
+        if (ackslot(a, i))
+          newest = i;
+    map = (const unsigned char *)packet->payload + packet->length;
+    for (i = 0; i < 8 * packet->sacklen; i++) {
+      if (map[i / 8] == 0) {
+        i += 7;
+        continue;
+      }
+      if (map[i / 8] & (1 << (i % 8))) {
+        index = (offset + 1 + i) % a->seqspace;
+        if (index < a->windowcount && ackslot(a, index) && index > newest)
+          newest = index;
       }
-      index = (index + 1) % WINDOWSIZE;
     }
+  }
 
-    /* Slide window forward only over in-order ACKed packets */
-    while (windowcount > 0 && acked[windowfirst]) {
-      acked[windowfirst] = false;
-      windowfirst = (windowfirst + 1) % WINDOWSIZE;
-      windowcount--;
+  if (newest >= 0) {
+    if (TRACE_ABOVE(0))
+      printf("----%c: ACK %d is not a duplicate\n", e->name, packet->acknum);
+    s->stats.new_ACKs++;
+    /* Karn: a resent packet's ACK may be for either copy.  Only the
+       newest packet ACKed is timed, the others may have waited for it. */
+    index = (a->windowfirst + newest) % a->windowsize;
+    if (!a->resent[index]) {
+      rto_sample(&a->rto, s->time - a->sendtime[index]);
+      if (e->self == A)
+        rto_report(&a->rto, &s->stats);
     }
- 
-    stoptimer(A);
-    
-    for (i = 0; i < windowcount; i++) {
-      if (!acked[(windowfirst + i) % WINDOWSIZE]) {
-        has_unacked = true;
-        break;
-       }
-      }
-      if (has_unacked)
-        starttimer(A, RTT);
+    /* the peer is getting packets through: stop backing off */
+    for (i = 0; i < a->windowcount; i++)
+      a->retries[(a->windowfirst + i) % a->windowsize] = 0;
   } else {
-    if (TRACE > 0)
-      printf("----A: corrupted ACK is received, do nothing!\n");
+    if (TRACE_ABOVE(0))
+      printf("----%c: duplicate ACK received, do nothing!\n", e->name);
   }
-}
 
+  /* Slide window forward only over in-order ACKed packets */
+  while (a->windowcount > 0 && a->acked[a->windowfirst]) {
+    a->acked[a->windowfirst] = false;
+    a->windowfirst = (a->windowfirst + 1) % a->windowsize;
+    a->windowcount--;
+  }
+}
 
-void A_timerinterrupt(void)
+/* the receiver's half of an incoming packet: its data */
+static void datainput(struct sim *s, struct entity *e, const struct pkt *packet)
 {
-  int i;
- 
-
-  current_time += RTT;  
-  if (TRACE > 0) 
-    printf("----A: time out,resend packets!\n");
-  for (i = 0; i < windowcount; i++) {
-    int index = (windowfirst + i) % WINDOWSIZE;
-    if (!acked[index] && timer_active[index] && current_time >= timer_expiry[index]) {
-      if (TRACE > 0)
-       printf("---A: resending packet %d\n", buffer[index].seqnum);
-      
-      tolayer3(A, buffer[index]);
-      packets_resent++;
-      timer_expiry[index] = current_time + RTT;
-      break; 
-   }
- }
- for (i = 0; i < windowcount; i++) {
-    int index = (windowfirst + i) % WINDOWSIZE;
-    if (!acked[index]) {
-      starttimer(A, RTT);
-      return;
+  struct receiver *b = &e->rcv;
+  int offset, slot;
+  bool gap;
+
+  if (TRACE_ABOVE(0))
+    printf("----%c: packet %d is correctly received, send ACK!\n", e->name, packet->seqnum);
+  s->stats.packets_received++;
+
+  /* Store packet in buffer if within window.  Anything else is a
+     resend of a packet already delivered, which is only ACKed again. */
+  offset = (packet->seqnum - b->expectedseqnum + b->seqspace) % b->seqspace;
+  if (offset < b->windowsize) {
+    slot = (b->recvfirst + offset) % b->windowsize;
+    if (!b->received[slot]) {
+      pkt_copy(&b->recv_buffer[slot], packet);
+      b->received[slot] = true;
+      b->nbuffered++;
     }
   }
-}
-
 
+  /* anything but the next packet with nothing after it is a gap */
+  gap = offset != 0 || b->nbuffered > 1;
+
+  /* Deliver all in-order packets starting from expectedseqnum */
+  while (b->received[b->recvfirst]) {
+    tolayer5(s, e->self, b->recv_buffer[b->recvfirst].payload,
+             b->recv_buffer[b->recvfirst].length);
+    b->received[b->recvfirst] = false;
+    b->nbuffered--;
+    b->recvfirst = (b->recvfirst + 1) % b->windowsize;
+    b->expectedseqnum = (b->expectedseqnum + 1) % b->seqspace;
+  }
 
+  /* ACK this packet */
+  b->last_acked_seq = packet->seqnum;
+  oweack(s, e, packet->seqnum, gap);
+}
 
-void A_init(void)
+static void input(struct sim *s, struct entity *e, const struct pkt *packet)
 {
-  int i;
-  A_nextseqnum = 0;
-  windowfirst = 0;
-  windowlast = -1;
-  windowcount = 0;
-  for (i = 0; i < WINDOWSIZE; i++) {
-    timer_active[i] = false;
-    timer_expiry[i] = 0.0;
+  if (IsCorrupted(s, packet)) {
+    if (!e->hasdata) {
+      if (TRACE_ABOVE(0))
+        printf("----%c: corrupted ACK is received, do nothing!\n", e->name);
+      return;
+    }
+    if (TRACE_ABOVE(0))
+      printf("----%c: packet corrupted or not expected sequence number, resend ACK!\n", e->name);
+    /* an ACK already waiting tells the sender as much, unless it is
+       being delayed */
+    if (e->ackcount == 0 || s->config.ackevery > 1)
+      oweack(s, e, e->rcv.last_acked_seq, true);
+    return;
   }
-  current_time = 0.0;
+  if (packet->acknum != NOTINUSE)
+    ackinput(s, e, packet);
+  if (packet->seqnum != NOTINUSE)
+    datainput(s, e, packet);
+  rearm(s, e);
 }
 
-/********* Receiver (B)  variables and procedures ************/
-
-static int expectedseqnum;
-static int B_nextseqnum;
-
-#define RCV_BUFFER_SIZE SEQSPACE
+static void timerinterrupt(struct sim *s, struct entity *e)
+{
+  struct sender *a = &e->snd;
+  double now;
+  int slot;
+
+  /* the timer was armed for timer_armed; s->time may differ from it by
+     rounding, so every deadline up to the later of the two has expired */
+  now = e->timer_armed > s->time ? e->timer_armed : s->time;
+  e->timer_running = false;
+  if (a->ndeadlines > 0 && a->timer_expiry[a->deadlines[0]] <= now &&
+      TRACE_ABOVE(0))
+    printf("----%c: time out,resend packets!\n", e->name);
+  while (a->ndeadlines > 0 && a->timer_expiry[a->deadlines[0]] <= now) {
+    slot = a->deadlines[0];
+    if (TRACE_ABOVE(0))
+      printf("---%c: resending packet %d\n", e->name, a->buffer[slot].seqnum);
+    sendslot(s, e, slot);
+    s->stats.packets_resent++;
+    a->resent[slot] = true;
+    if (a->rto.adaptive && a->retries[slot] < MAXBACKOFF)
+      a->retries[slot]++;
+    deadline_set(a, slot, s->time + rto_timeout(&a->rto) * (1 << a->retries[slot]));
+  }
+  while (e->ackcount > 0 && e->ackdue[e->ackfirst] <= now) {
+    if (TRACE_ABOVE(0))
+      printf("----%c: held ACK is due, send it alone\n", e->name);
+    sendack(s, e, popack(e));
+  }
+  rearm(s, e);
+}
 
-static struct pkt recv_buffer[RCV_BUFFER_SIZE];
-static bool received[RCV_BUFFER_SIZE];
-void B_input(struct pkt packet)
+static void init(struct sim *s, int AorB)
 {
-  struct pkt ackpkt;
+  struct entity *e = sim_alloc(s, sizeof(struct entity));
+  struct sender *a = &e->snd;
+  struct receiver *b = &e->rcv;
   int i;
 
-  if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
-   packets_received++;
+  s->state[AorB] = e;
+  e->self = AorB;
+  e->name = AorB == A ? 'A' : 'B';
+  e->hasdata = AorB == B || s->config.bidirectional;
+  e->holdacks = s->config.bidirectional || s->config.ackevery > 1;
+  e->ackhold = s->config.ackdelay > 0 ? s->config.ackdelay : ACKHOLD;
+  e->unacked = 0;
+  if (s->config.ackevery > 1 && !s->config.sack) {
+    printf("SR can only delay ACKs that are cumulative (acks = sack)\n");
+    exit(EXIT_FAILURE);
+  }
 
-    /* Store packet in buffer if within window */
-    if (!received[packet.seqnum]) {
-      recv_buffer[packet.seqnum] = packet;
-      received[packet.seqnum] = true;
-    }
+  /* The window buffers hold windowsize packets of up to 64 KB each, so
+     an end only gets the ones it uses: sending one way only, B sends
+     nothing but ACKs and A receives nothing but ACKs.  An empty send
+     window never touches its arrays. */
+  getwindow(s, &a->windowsize, &a->seqspace);
+  if (AorB == A || s->config.bidirectional) {
+    a->buffer = sim_allocpkts(s, a->windowsize);
+    a->acked = sim_alloc(s, a->windowsize * sizeof(bool));
+    a->sendtime = sim_alloc(s, a->windowsize * sizeof(double));
+    a->timer_expiry = sim_alloc(s, a->windowsize * sizeof(double));
+    a->resent = sim_alloc(s, a->windowsize * sizeof(bool));
+    a->retries = sim_alloc(s, a->windowsize * sizeof(int));
+    a->deadlines = sim_alloc(s, a->windowsize * sizeof(int));
+    a->heappos = sim_alloc(s, a->windowsize * sizeof(int));
+    for (i = 0; i < a->windowsize; i++)
+      a->heappos[i] = -1;
+  }
+  a->A_nextseqnum = 0;
+  a->windowfirst = 0;
+  a->windowlast = -1;
+  a->windowcount = 0;
+  a->ndeadlines = 0;
+  /* the peer may hold its ACK back, so wait that much longer */
+  rto_init(&a->rto, s->config.adaptive_rto,
+           e->holdacks ? RTT + e->ackhold : RTT);
+  if (AorB == A)
+    rto_report(&a->rto, &s->stats);
+
+  getwindow(s, &b->windowsize, &b->seqspace);
+  if (e->hasdata) {
+    b->recv_buffer = sim_allocpkts(s, b->windowsize);
+    b->received = sim_alloc(s, b->windowsize * sizeof(bool));
+  }
+  b->recvfirst = 0;
+  b->nbuffered = 0;
+  b->expectedseqnum = 0;
+  b->last_acked_seq = b->seqspace - 1;
+
+  e->acksize = b->windowsize;
+  e->ackq = sim_alloc(s, e->acksize * sizeof(int));
+  e->ackdue = sim_alloc(s, e->acksize * sizeof(double));
+  e->ackfirst = 0;
+  e->ackcount = 0;
+  e->timer_running = false;
+  e->timer_armed = 0.0;
+}
 
-    /* Deliver all in-order packets starting from expectedseqnum */
-    while (received[expectedseqnum]) {
-      tolayer5(B, recv_buffer[expectedseqnum].payload);
-      received[expectedseqnum] = false;
-      expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
-    }
+/********* A's entry points ************/
 
-    /* Send ACK for this packet */
-    last_acked_seq = packet.seqnum;
-    ackpkt.acknum = packet.seqnum;
-  } else {
-    if (TRACE > 0)
-      printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
+static void A_output(struct sim *s, struct msg message)
+{
+  output(s, s->state[A], message);
+}
 
-    ackpkt.acknum = last_acked_seq;
+static void A_input(struct sim *s, const struct pkt *packet)
+{
+  input(s, s->state[A], packet);
+}
 
-  }
+static void A_timerinterrupt(struct sim *s)
+{
+  timerinterrupt(s, s->state[A]);
+}
 
-  ackpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
+static void A_init(struct sim *s)
+{
+  init(s, A);
+}
 
-  for (i = 0; i < 20; i++)
-    ackpkt.payload[i] = '0';
+/********* B's entry points ************/
 
-  ackpkt.checksum = ComputeChecksum(ackpkt);
-  tolayer3(B, ackpkt);
+static void B_input(struct sim *s, const struct pkt *packet)
+{
+  input(s, s->state[B], packet);
 }
 
-void B_init(void)
+static void B_init(struct sim *s)
 {
-  int i;
-expectedseqnum = 0;
-B_nextseqnum = 1;
-last_acked_seq = SEQSPACE - 1;
-
-for (i = 0; i < RCV_BUFFER_SIZE; i++) {
-  received[i] = false;
-}
+  init(s, B);
 }
 
-void B_output(struct msg message)
+/* B only has data to send with config.bidirectional */
+static void B_output(struct sim *s, struct msg message)
 {
+  output(s, s->state[B], message);
 }
 
-void B_timerinterrupt(void)
+static void B_timerinterrupt(struct sim *s)
 {
+  timerinterrupt(s, s->state[B]);
 }
+
+const struct protocol sr_protocol = {
+  "sr",
+  A_init, B_init, A_output, B_output, A_input, B_input,
+  A_timerinterrupt, B_timerinterrupt
+};
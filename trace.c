@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+struct tracelog *tracelog_open(const char *path, unsigned cap)
+{
+  struct tracelog *log;
+  uint32_t recsize = sizeof(struct tracerec);
+
+  log = malloc(sizeof(struct tracelog));
+  if (log == NULL)
+    return NULL;
+  log->ring = malloc(cap * sizeof(struct tracerec));
+  log->fp = fopen(path, "wb");
+  if (log->ring == NULL || log->fp == NULL) {
+    if (log->fp != NULL)
+      fclose(log->fp);
+    free(log->ring);
+    free(log);
+    return NULL;
+  }
+  log->n = 0;
+  log->cap = cap;
+  fwrite(TRACELOG_MAGIC, 1, strlen(TRACELOG_MAGIC), log->fp);
+  fwrite(&recsize, sizeof(recsize), 1, log->fp);
+  return log;
+}
+
+void tracelog_flush(struct tracelog *log)
+{
+  if (log->n > 0 && fwrite(log->ring, sizeof(struct tracerec), log->n, log->fp) != log->n) {
+    perror("event log");
+    exit(EXIT_FAILURE);
+  }
+  log->n = 0;
+}
+
+void tracelog_close(struct tracelog *log)
+{
+  tracelog_flush(log);
+  fclose(log->fp);
+  free(log->ring);
+  free(log);
+}
@@ -0,0 +1,68 @@
+/* Binary event log.  Instead of formatting text on stdout, the emulator
+   can append a fixed-size record for each event to an in-memory ring
+   that is written out to a file whenever it fills up and when the
+   simulation ends.  tracedump renders a log in the emulator's usual
+   trace format.  Records are only written when TRACE_MAX >= 1. */
+#include <stdio.h>
+#include <stdint.h>
+
+#define TRACELOG_MAGIC "SIMLOG01"
+
+/* record types */
+#define TR_FROMLAYER5   1   /* message from layer 5; seq = message number */
+#define TR_TOLAYER3     2   /* packet handed to layer 3 */
+#define TR_LOST         3   /* ... and lost by the medium */
+#define TR_CORRUPT      4   /* ... and corrupted by the medium */
+#define TR_FROMLAYER3   5   /* packet delivered to the entity */
+#define TR_TIMEOUT      6   /* timer interrupt */
+#define TR_STARTTIMER   7   /* timer started; value = timeout */
+#define TR_STOPTIMER    8   /* timer stopped */
+#define TR_TOLAYER5     9   /* data delivered to layer 5 */
+#define TR_CWND        10   /* congestion window changed; value = cwnd */
+#define TR_QDROP       11   /* packet handed to layer 3 dropped, the link's queue being full */
+
+struct tracerec {
+  double time;              /* simulated time of the event */
+  double value;             /* type specific */
+  int32_t seq;              /* sequence number (if any) */
+  int32_t ack;              /* acknowledgement number (if any) */
+  int32_t checksum;         /* checksum (if any) */
+  uint8_t type;             /* TR_* */
+  uint8_t entity;           /* A or B */
+  uint8_t pad[2];
+};
+
+struct tracelog {
+  FILE *fp;
+  struct tracerec *ring;
+  unsigned n;               /* records waiting in the ring */
+  unsigned cap;             /* size of the ring */
+};
+
+/* create a log writing to path, buffering cap records; NULL on failure */
+extern struct tracelog *tracelog_open(const char *path, unsigned cap);
+
+/* write out the records held in the ring */
+extern void tracelog_flush(struct tracelog *log);
+
+/* flush and close the log */
+extern void tracelog_close(struct tracelog *log);
+
+static inline void tracelog_put(struct tracelog *log, int type, int entity,
+                                double time, int seq, int ack, int checksum,
+                                double value)
+{
+  struct tracerec *r;
+
+  if (log->n == log->cap)
+    tracelog_flush(log);
+  r = &log->ring[log->n++];
+  r->time = time;
+  r->value = value;
+  r->seq = seq;
+  r->ack = ack;
+  r->checksum = checksum;
+  r->type = type;
+  r->entity = entity;
+  r->pad[0] = r->pad[1] = 0;
+}
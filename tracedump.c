@@ -0,0 +1,100 @@
+/* ******************************************************************
+   tracedump: print a binary event log written by the emulator (see
+   trace.h) in the emulator's human-readable trace format.
+
+   usage: tracedump logfile
+**********************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+#define NRECS 4096
+
+static const char *entityname(int entity)
+{
+  return entity == 0 ? "A" : "B";
+}
+
+static void printrec(const struct tracerec *r)
+{
+  switch (r->type) {
+  case TR_FROMLAYER5:
+    printf("\nEVENT time: %f,  type: 1, fromlayer5  entity: %d\n", r->time, r->entity);
+    printf("          MAINLOOP: message %d given to %s\n", r->seq, entityname(r->entity));
+    break;
+  case TR_FROMLAYER3:
+    printf("\nEVENT time: %f,  type: 2, fromlayer3  entity: %d\n", r->time, r->entity);
+    printf("          seq: %d, ack %d, check: %d\n", r->seq, r->ack, r->checksum);
+    break;
+  case TR_TIMEOUT:
+    printf("\nEVENT time: %f,  type: 0, timerinterrupt   entity: %d\n", r->time, r->entity);
+    break;
+  case TR_TOLAYER3:
+    printf("          TOLAYER3: seq: %d, ack %d, check: %d from %s\n",
+           r->seq, r->ack, r->checksum, entityname(r->entity));
+    break;
+  case TR_LOST:
+    printf("          TOLAYER3: packet being lost\n");
+    break;
+  case TR_CORRUPT:
+    printf("          TOLAYER3: packet being corrupted\n");
+    break;
+  case TR_STARTTIMER:
+    printf("          START TIMER: starting timer at %f (%s, timeout %f)\n",
+           r->time, entityname(r->entity), r->value);
+    break;
+  case TR_STOPTIMER:
+    printf("          STOP TIMER: stopping timer at %f (%s)\n", r->time, entityname(r->entity));
+    break;
+  case TR_TOLAYER5:
+    printf("          TOLAYER5: data received by application at %s (delivery %d)\n",
+           entityname(r->entity), r->seq);
+    break;
+  case TR_QDROP:
+    printf("          TOLAYER3: queue full, packet dropped\n");
+    break;
+  case TR_CWND:
+    printf("          CWND: congestion window at %s is %f\n", entityname(r->entity), r->value);
+    break;
+  default:
+    printf("          unknown record type %d at %f\n", r->type, r->time);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *fp;
+  char magic[sizeof(TRACELOG_MAGIC) - 1];
+  uint32_t recsize;
+  struct tracerec *recs;
+  size_t i, n;
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s logfile\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  fp = fopen(argv[1], "rb");
+  if (fp == NULL) {
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+      memcmp(magic, TRACELOG_MAGIC, sizeof(magic)) != 0 ||
+      fread(&recsize, sizeof(recsize), 1, fp) != 1 ||
+      recsize != sizeof(struct tracerec)) {
+    fprintf(stderr, "%s: not an event log from this version of the emulator\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  recs = malloc(NRECS * sizeof(struct tracerec));
+  if (recs == NULL) {
+    printf("memory allocation for records failed.");
+    return EXIT_FAILURE;
+  }
+  while ((n = fread(recs, sizeof(struct tracerec), NRECS, fp)) > 0)
+    for (i = 0; i < n; i++)
+      printrec(&recs[i]);
+  free(recs);
+  fclose(fp);
+  return EXIT_SUCCESS;
+}